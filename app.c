@@ -1,11 +1,25 @@
 #include "app.h"
+#include "asset.h"
+#include "batch.h"
+#include "cache.h"
+#include "jobs.h"
+#include "memstats.h"
+#include "mipmap.h"
+#include "scene.h"
+#include "stream.h"
+#include "telemetry.h"
 
 // Standard libraries
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 // TODO(cedmundo): make multiplatform
 #include <dlfcn.h>
@@ -16,6 +30,91 @@
 #include <GLFW/glfw3.h>
 #include <ktx.h>
 
+#define DEFAULT_UPLOAD_BUDGET (4 * 1024 * 1024)
+#define MAX_TEXTURE_LEVELS 32
+
+typedef enum {
+  SLOT_FREE,
+  SLOT_QUEUED,
+  SLOT_CANCELLED,
+  SLOT_DECODED,
+  SLOT_UPLOADING,
+  SLOT_READY,
+  SLOT_EVICTED,
+  SLOT_FAILED,
+} SlotState;
+
+// Describes the image data of a texture so it can be uploaded piecewise.
+typedef struct {
+  bool streamable;
+  GLenum target;
+  GLenum internalFormat;
+  GLenum format;
+  GLenum type;
+  bool compressed;
+  bool generateMipmaps;
+  int unpackAlignment;
+  unsigned width;
+  unsigned height;
+  unsigned levels;
+  unsigned layers;
+  unsigned firstLayer;
+  unsigned faces;
+  const unsigned char *data;
+  // Owned copy of every level when the mip chain was generated on the CPU
+  unsigned char *mipmaps;
+  size_t *offsets;
+  size_t levelSizes[MAX_TEXTURE_LEVELS];
+} TextureImage;
+
+// GL formats matching a VkFormat of KTX2 files, type is 0 when compressed.
+typedef struct {
+  unsigned vkFormat;
+  GLenum internalFormat;
+  GLenum format;
+  GLenum type;
+} FormatMapping;
+
+static const FormatMapping formatMappings[] = {
+    {23, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE},          // R8G8B8_UNORM
+    {29, GL_SRGB8, GL_RGB, GL_UNSIGNED_BYTE},         // R8G8B8_SRGB
+    {37, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},        // R8G8B8A8_UNORM
+    {43, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE}, // R8G8B8A8_SRGB
+    {131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, 0},
+    {132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 0, 0},
+    {133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 0, 0},
+    {134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, 0},
+    {137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, 0},
+    {138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, 0},
+    {139, GL_COMPRESSED_RED_RGTC1, 0, 0},
+    {141, GL_COMPRESSED_RG_RGTC2, 0, 0},
+    {145, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, 0, 0},
+    {146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, 0, 0},
+    {147, GL_COMPRESSED_RGB8_ETC2, 0, 0},
+    {148, GL_COMPRESSED_SRGB8_ETC2, 0, 0},
+    {151, GL_COMPRESSED_RGBA8_ETC2_EAC, 0, 0},
+    {152, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, 0, 0},
+    {157, GL_COMPRESSED_RGBA_ASTC_4x4_KHR, 0, 0},
+    {158, GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR, 0, 0},
+};
+
+// A loaded texture, state is shared with workers.
+typedef struct {
+  SlotState state;
+  StatusCode status;
+  unsigned id;
+  GLenum target;
+  char *path;
+  uint64_t sourceHash;
+  ktxTexture *src;
+  Asset asset;
+  TextureImage image;
+  unsigned nextImage;
+  size_t gpuBytes;
+  size_t cpuBytes;
+  unsigned long lastUse;
+} TextureSlot;
+
 typedef struct {
   bool didInitGLFW;
   float aspectRatio;
@@ -26,12 +125,61 @@ typedef struct {
   int fpsCount;
   int curFPS;
   GLFWwindow *window;
+  unsigned long frame;
+  ktx_transcode_fmt_e transcodeFormat;
+  GLenum transcodeInternalFormat;
+  size_t uploadBudget;
+  size_t cpuBudget;
+  size_t gpuBudget;
+  bool generateMipmaps;
+  unsigned uploadPBO;
+  pthread_mutex_t loadLock;
+  TextureSlot *slots;
+  unsigned slotCount;
+  atomic_int swapInterval;
+  atomic_bool swapIntervalChanged;
+  atomic_llong framePeriod;
+  long long frameDeadline;
+  bool pipelined;
+  int framebufferWidth;
+  int framebufferHeight;
+  double inputTime;
 } App;
 
-static App app = {0};
+// Frame info sent along a pipeline snapshot, inputTime in telemetry time.
+typedef struct {
+  double inputTime;
+  float deltaTime;
+  int framebufferWidth;
+  int framebufferHeight;
+} SnapshotInfo;
 
-char *LoadFileContents(const char *name);
-void UnloadFileContents(char *);
+// Snapshots rotate between the writer, the ready spot and the reader, fresh
+// is set while the ready snapshot was not rendered yet.
+typedef struct {
+  const FramePipeline *config;
+  unsigned char *snapshots;
+  SnapshotInfo info[3];
+  int write;
+  int ready;
+  int read;
+  bool fresh;
+  bool stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} Pipeline;
+
+static App app = {
+    .uploadBudget = DEFAULT_UPLOAD_BUDGET,
+    .loadLock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void PumpTextureUploads();
+static void EnforceTextureBudget();
+static void DescribeTextureImage(ktxTexture *src, TextureImage *image);
+static void ReleaseTextureSlot(TextureSlot *slot);
+static void DecodeTextureJob(void *arg);
+static size_t UploadTextureSlot(TextureSlot *slot, size_t budget);
 
 int Exit(StatusCode status) {
   assert(status >= SUCCESS && status < E_ERROR_COUNT &&
@@ -44,8 +192,35 @@ int Exit(StatusCode status) {
   return 0;
 }
 
-StatusCode AppInit(int window_width, int window_height,
-                   const char *window_title) {
+// Pick the best compressed format Basis textures can be transcoded to on this
+// device, falling back to plain RGBA8. Also gives the GL format it becomes.
+static ktx_transcode_fmt_e SelectTranscodeFormat(GLenum *internalFormat) {
+  if (GLAD_GL_KHR_texture_compression_astc_ldr) {
+    *internalFormat = GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+    return KTX_TTF_ASTC_4x4_RGBA;
+  }
+
+  if (GLAD_GL_ARB_texture_compression_bptc) {
+    *internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+    return KTX_TTF_BC7_RGBA;
+  }
+
+  if (GLAD_GL_ARB_ES3_compatibility) {
+    *internalFormat = GL_COMPRESSED_RGBA8_ETC2_EAC;
+    return KTX_TTF_ETC2_RGBA;
+  }
+
+  if (GLAD_GL_EXT_texture_compression_s3tc) {
+    *internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    return KTX_TTF_BC3_RGBA;
+  }
+
+  *internalFormat = GL_RGBA8;
+  return KTX_TTF_RGBA32;
+}
+
+static StatusCode InitWindow(int window_width, int window_height,
+                             const char *window_title, bool visible) {
   // Init GLFW.
   if (!glfwInit()) {
     return E_CANNOT_INIT_GLFW;
@@ -61,6 +236,7 @@ StatusCode AppInit(int window_width, int window_height,
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
   // Create window.
   app.window =
@@ -75,16 +251,63 @@ StatusCode AppInit(int window_width, int window_height,
     return E_CANNOT_LOAD_GL;
   }
 
+  // Visible windows sync to the display, hidden ones present nothing
+  app.swapInterval = visible ? 1 : 0;
+  glfwSwapInterval(app.swapInterval);
+
+  // Workers decode textures loaded with AppLoadTextureAsync
+  app.transcodeFormat = SelectTranscodeFormat(&app.transcodeInternalFormat);
+  JobsInit(0);
+
   glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
   return SUCCESS;
 }
 
+StatusCode AppInit(int window_width, int window_height,
+                   const char *window_title) {
+  return InitWindow(window_width, window_height, window_title, true);
+}
+
+StatusCode AppInitOffscreen(int width, int height) {
+  return InitWindow(width, height, "SimpleKTX", false);
+}
+
 bool AppShouldClose() {
   assert(app.window != NULL && "invalid state: app.window is not initialized");
   return glfwWindowShouldClose(app.window);
 }
 
 void AppClose() {
+  // Workers must be stopped before releasing the slots they write to, names
+  // are deleted here as workers never touch GL
+  JobsShutdown();
+  for (unsigned i = 0; i < app.slotCount; i++) {
+    unsigned id = app.slots[i].id;
+    if (app.slots[i].state != SLOT_FREE) {
+      ReleaseTextureSlot(&app.slots[i]);
+    }
+
+    if (id != 0) {
+      glDeleteTextures(1, &id);
+    }
+  }
+  free(app.slots);
+  app.slots = NULL;
+  app.slotCount = 0;
+
+  if (app.uploadPBO != 0) {
+    glDeleteBuffers(1, &app.uploadPBO);
+    app.uploadPBO = 0;
+  }
+
+  SceneShutdown();
+  BatchShutdown();
+  StreamShutdown();
+  CacheShutdown();
+  TelemetryShutdown();
+  MemoryShutdown();
+  AssetUnmountBundle();
+
   if (app.window != NULL) {
     glfwDestroyWindow(app.window);
   }
@@ -96,11 +319,18 @@ void AppClose() {
 
 void AppBeginFrame() {
   assert(app.window != NULL && "invalid state: app.window is not initialized");
+  TelemetryBeginFrame();
+  MemoryBeginFrame();
   int width = 0;
   int height = 0;
 
-  // Framebuffer resize and aspect ratio
-  glfwGetFramebufferSize(app.window, &width, &height);
+  // Framebuffer resize and aspect ratio, pipelines query it with the events
+  if (app.pipelined) {
+    width = app.framebufferWidth;
+    height = app.framebufferHeight;
+  } else {
+    glfwGetFramebufferSize(app.window, &width, &height);
+  }
   app.aspectRatio = (float)width / (float)height;
 
   // Uptime and delta time
@@ -117,43 +347,359 @@ void AppBeginFrame() {
     app.fpsTime = 0.0f;
   }
 
+  // Upload texture data decoded in background and keep memory in budget
+  app.frame += 1;
+  PumpTextureUploads();
+  EnforceTextureBudget();
+
   // Clear buffer and start frame
   glViewport(0, 0, width, height);
   glClear(GL_COLOR_BUFFER_BIT);
 }
 
+// Monotonic time in nanoseconds, the clock the frame limiter sleeps on.
+static long long MonotonicNanos() {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Sleep until deadline and move it one frame period forward.
+static void LimitFrameRate(long long *deadline) {
+  long long period = app.framePeriod;
+  if (period <= 0) {
+    return;
+  }
+
+  long long now = MonotonicNanos();
+  if (*deadline > now) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(*deadline / 1000000000LL),
+        .tv_nsec = (long)(*deadline % 1000000000LL),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+    now = *deadline;
+  }
+
+  // Late frames restart the schedule instead of rushing to catch up
+  *deadline = *deadline + period > now ? *deadline + period : now + period;
+}
+
 void AppEndFrame() {
   assert(app.window != NULL && "invalid state: app.window is not initialized");
-  glfwPollEvents();
+  TelemetryEndFrame();
+  StreamEndFrame();
+  if (atomic_exchange(&app.swapIntervalChanged, false)) {
+    glfwSwapInterval(app.swapInterval);
+  }
+
   glfwSwapBuffers(app.window);
+  if (app.inputTime > 0.0) {
+    TelemetryRecordLatency(app.inputTime);
+  }
+
+  // Pipelines poll events on the main thread
+  if (app.pipelined) {
+    return;
+  }
+
+  // Poll after sleeping so the next frame sees the freshest input
+  LimitFrameRate(&app.frameDeadline);
+  glfwPollEvents();
+  app.inputTime = TelemetryNow();
+}
+
+void AppSetSwapInterval(int interval) {
+  assert(interval >= 0 && "invalid arg interval: cannot be negative");
+  app.swapInterval = interval;
+  app.swapIntervalChanged = true;
+}
+
+void AppSetFrameRateLimit(float framesPerSecond) {
+  assert(framesPerSecond >= 0.0f &&
+         "invalid arg framesPerSecond: cannot be negative");
+  app.framePeriod =
+      framesPerSecond > 0.0f ? (long long)(1e9 / framesPerSecond) : 0;
+}
+
+static void *RenderMain(void *arg) {
+  Pipeline *pipeline = arg;
+  const FramePipeline *config = pipeline->config;
+  glfwMakeContextCurrent(app.window);
+
+  pthread_mutex_lock(&pipeline->lock);
+  while (true) {
+    while (!pipeline->fresh && !pipeline->stopping) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+
+    if (pipeline->stopping) {
+      break;
+    }
+
+    // Take the newest snapshot, the old one goes back to the ready spot
+    int read = pipeline->ready;
+    pipeline->ready = pipeline->read;
+    pipeline->read = read;
+    pipeline->fresh = false;
+    SnapshotInfo info = pipeline->info[read];
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    app.framebufferWidth = info.framebufferWidth;
+    app.framebufferHeight = info.framebufferHeight;
+    app.inputTime = info.inputTime;
+    AppBeginFrame();
+    config->render(config->user,
+                   pipeline->snapshots + (size_t)read * config->snapshotSize);
+    AppEndFrame();
+
+    pthread_mutex_lock(&pipeline->lock);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+
+  glfwMakeContextCurrent(NULL);
+  return NULL;
+}
+
+StatusCode AppRunPipeline(const FramePipeline *config) {
+  assert(app.window != NULL && "invalid state: app.window is not initialized");
+  assert(config != NULL && "invalid arg config: cannot be NULL");
+  assert(config->update != NULL && "invalid arg config: update is NULL");
+  assert(config->render != NULL && "invalid arg config: render is NULL");
+  Pipeline pipeline = {
+      .config = config,
+      .snapshots = calloc(3, config->snapshotSize ? config->snapshotSize : 1),
+      .write = 0,
+      .ready = 1,
+      .read = 2,
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+      .changed = PTHREAD_COND_INITIALIZER,
+  };
+  if (pipeline.snapshots == NULL) {
+    return E_CANNOT_START_PIPELINE;
+  }
+
+  // The render thread owns the context until the pipeline stops
+  pthread_t renderThread;
+  app.pipelined = true;
+  glfwMakeContextCurrent(NULL);
+  if (pthread_create(&renderThread, NULL, RenderMain, &pipeline) != 0) {
+    glfwMakeContextCurrent(app.window);
+    app.pipelined = false;
+    free(pipeline.snapshots);
+    return E_CANNOT_START_PIPELINE;
+  }
+
+  long long deadline = 0;
+  double lastUpdate = glfwGetTime();
+  while (!glfwWindowShouldClose(app.window)) {
+    LimitFrameRate(&deadline);
+    if (!config->dropFrames) {
+      pthread_mutex_lock(&pipeline.lock);
+      while (pipeline.fresh) {
+        pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+      }
+      pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    glfwPollEvents();
+    SnapshotInfo info = {.inputTime = TelemetryNow()};
+    glfwGetFramebufferSize(app.window, &info.framebufferWidth,
+                           &info.framebufferHeight);
+
+    double now = glfwGetTime();
+    info.deltaTime = (float)(now - lastUpdate);
+    lastUpdate = now;
+    config->update(config->user,
+                   pipeline.snapshots +
+                       (size_t)pipeline.write * config->snapshotSize,
+                   info.deltaTime);
+
+    // Publish, a snapshot render did not take yet is overwritten
+    pthread_mutex_lock(&pipeline.lock);
+    int ready = pipeline.write;
+    pipeline.write = pipeline.ready;
+    pipeline.ready = ready;
+    pipeline.info[ready] = info;
+    pipeline.fresh = true;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+  }
+
+  pthread_mutex_lock(&pipeline.lock);
+  pipeline.stopping = true;
+  pthread_cond_broadcast(&pipeline.changed);
+  pthread_mutex_unlock(&pipeline.lock);
+  pthread_join(renderThread, NULL);
+
+  glfwMakeContextCurrent(app.window);
+  app.pipelined = false;
+  app.inputTime = 0.0;
+  free(pipeline.snapshots);
+  return SUCCESS;
+}
+
+#define PROGRAM_BINARY_MAGIC 0x42504b53u // "SKPB"
+
+// Header of a cached program binary, followed by the binary itself.
+typedef struct {
+  uint32_t magic;
+  uint32_t binaryFormat;
+  uint64_t key;
+  uint32_t length;
+  uint32_t reserved;
+} ProgramBinaryHeader;
+
+static bool HasProgramBinaries() {
+  GLint formats = 0;
+  if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary) {
+    return false;
+  }
+
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+// Binaries are only valid for the same sources on the same driver. The vertex
+// source size separates it from the fragment one.
+static uint64_t ProgramBinaryKey(const Asset *vsSource, const Asset *fsSource) {
+  const char *strings[] = {
+      (const char *)glGetString(GL_VENDOR),
+      (const char *)glGetString(GL_RENDERER),
+      (const char *)glGetString(GL_VERSION),
+  };
+
+  uint64_t key = AssetHash(ASSET_HASH_SEED, vsSource->data, vsSource->size);
+  key = AssetHash(key, &vsSource->size, sizeof(vsSource->size));
+  key = AssetHash(key, fsSource->data, fsSource->size);
+  for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+    if (strings[i] != NULL) {
+      key = AssetHash(key, strings[i], strlen(strings[i]) + 1);
+    }
+  }
+
+  return key;
+}
+
+// Create a program from the cached binary of key, returns 0 when there is none
+// or the driver rejects it.
+static unsigned LoadProgramBinary(uint64_t key) {
+  char path[PATH_MAX];
+  Asset asset = {0};
+  if (!AssetCachePath(key, "program", path, sizeof(path)) ||
+      !AssetOpen(path, ASSET_READ_SEQUENTIAL, &asset)) {
+    return 0;
+  }
+
+  ProgramBinaryHeader header = {0};
+  if (asset.size < sizeof(header)) {
+    AssetClose(&asset);
+    return 0;
+  }
+
+  memcpy(&header, asset.data, sizeof(header));
+  if (header.magic != PROGRAM_BINARY_MAGIC || header.key != key ||
+      header.length != asset.size - sizeof(header)) {
+    AssetClose(&asset);
+    return 0;
+  }
+
+  int glStatus = 0;
+  unsigned program = glCreateProgram();
+  glProgramBinary(program, header.binaryFormat, asset.data + sizeof(header),
+                  (GLsizei)header.length);
+  glGetProgramiv(program, GL_LINK_STATUS, &glStatus);
+  AssetClose(&asset);
+  if (!glStatus) {
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  return program;
+}
+
+static void SaveProgramBinary(unsigned program, uint64_t key) {
+  char path[PATH_MAX];
+  GLint length = 0;
+  if (!AssetCachePath(key, "program", path, sizeof(path))) {
+    return;
+  }
+
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+
+  ProgramBinaryHeader *header = calloc(1, sizeof(*header) + length);
+  if (header == NULL) {
+    return;
+  }
+
+  GLenum binaryFormat = 0;
+  glGetProgramBinary(program, length, &length, &binaryFormat, header + 1);
+  *header = (ProgramBinaryHeader){
+      .magic = PROGRAM_BINARY_MAGIC,
+      .binaryFormat = binaryFormat,
+      .key = key,
+      .length = (uint32_t)length,
+  };
+
+  if (!AssetWrite(path, header, sizeof(*header) + length)) {
+    fprintf(stderr, "cannot write program binary: %s\n", path);
+  }
+  free(header);
+}
+
+void AppSetCacheDir(const char *dir) { AssetSetCacheDir(dir); }
+
+StatusCode AppMountBundle(const char *path) {
+  return AssetMountBundle(path) ? SUCCESS : E_CANNOT_LOAD_FILE;
 }
 
 Shader AppLoadShader(const char *vsPath, const char *fsPath) {
-  Shader shader = {0};
+  Shader shader = {.viewProjLocation = -1};
   int glStatus = 0;
-  char *vsSource = NULL;
-  char *fsSource = NULL;
+  Asset vsSource = {0};
+  Asset fsSource = {0};
   unsigned vsId = 0;
   unsigned fsId = 0;
   char shaderLog[512] = {0};
+  bool useBinary = false;
+  uint64_t binaryKey = 0;
 
-  vsSource = LoadFileContents(vsPath);
-  if (vsSource == NULL) {
+  AppTimerBegin("shader");
+  if (!AssetOpen(vsPath, ASSET_READ_SEQUENTIAL, &vsSource)) {
     // TODO(cedmundo): Add log messages
     shader.status = E_CANNOT_LOAD_FILE;
     goto terminate;
   }
 
-  fsSource = LoadFileContents(fsPath);
-  if (fsSource == NULL) {
+  if (!AssetOpen(fsPath, ASSET_READ_SEQUENTIAL, &fsSource)) {
     // TODO(cedmundo): Add log messages
     shader.status = E_CANNOT_LOAD_FILE;
     goto terminate;
   }
 
+  // Skip the compiler entirely when a cached binary is accepted
+  useBinary = HasProgramBinaries();
+  if (useBinary) {
+    binaryKey = ProgramBinaryKey(&vsSource, &fsSource);
+    shader.spId = LoadProgramBinary(binaryKey);
+    if (shader.spId != 0) {
+      shader.status = SUCCESS;
+      goto terminate;
+    }
+  }
+
+  // Mapped sources are not NUL terminated, lengths are explicit
   glStatus = 0;
   vsId = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vsId, 1, (const char **)&vsSource, NULL);
+  const char *vsText = (const char *)vsSource.data;
+  GLint vsLength = (GLint)vsSource.size;
+  glShaderSource(vsId, 1, &vsText, &vsLength);
   glCompileShader(vsId);
   glGetShaderiv(vsId, GL_COMPILE_STATUS, &glStatus);
   if (!glStatus) {
@@ -166,7 +712,9 @@ Shader AppLoadShader(const char *vsPath, const char *fsPath) {
 
   glStatus = 0;
   fsId = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fsId, 1, (const char **)&fsSource, NULL);
+  const char *fsText = (const char *)fsSource.data;
+  GLint fsLength = (GLint)fsSource.size;
+  glShaderSource(fsId, 1, &fsText, &fsLength);
   glCompileShader(fsId);
   glGetShaderiv(fsId, GL_COMPILE_STATUS, &glStatus);
   if (!glStatus) {
@@ -180,17 +728,25 @@ Shader AppLoadShader(const char *vsPath, const char *fsPath) {
   shader.spId = glCreateProgram();
   glAttachShader(shader.spId, vsId);
   glAttachShader(shader.spId, fsId);
+  if (useBinary) {
+    glProgramParameteri(shader.spId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  }
   glLinkProgram(shader.spId);
-  glGetShaderiv(shader.spId, GL_LINK_STATUS, &glStatus);
+  glGetProgramiv(shader.spId, GL_LINK_STATUS, &glStatus);
   if (!glStatus) {
     // TODO(cedmundo): Add log messages
     shader.status = E_SHADER_LINK_ERROR;
-    glGetShaderInfoLog(shader.spId, 512, NULL, shaderLog);
+    glGetProgramInfoLog(shader.spId, 512, NULL, shaderLog);
     fprintf(stderr, "cannot link shader program: %s\n", shaderLog);
     goto terminate;
   }
   shader.status = SUCCESS;
 
+  if (useBinary) {
+    SaveProgramBinary(shader.spId, binaryKey);
+  }
+
 terminate:
   if (vsId != 0) {
     glDetachShader(shader.spId, vsId);
@@ -204,109 +760,1332 @@ terminate:
 
   if (shader.status != SUCCESS) {
     AppDestroyShader(shader);
-  }
+  } else {
+    shader.viewProjLocation = glGetUniformLocation(shader.spId, "viewProj");
 
-  if (vsSource != NULL) {
-    free(vsSource);
+    // Drivers do not expose program sizes, the binary is the best estimate
+    GLint binaryLength = 0;
+    if (useBinary) {
+      glGetProgramiv(shader.spId, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    }
+    MemoryTrack(MEMORY_GPU_PROGRAM, shader.spId, (size_t)binaryLength, 0, 0,
+                vsPath);
   }
 
-  if (fsSource != NULL) {
-    free(fsSource);
-  }
+  AssetClose(&vsSource);
+  AssetClose(&fsSource);
+  AppTimerEnd();
 
   return shader;
 }
 
 void AppDestroyShader(Shader shader) {
   if (shader.spId != 0) {
+    MemoryUntrack(MEMORY_GPU_PROGRAM, shader.spId);
     glDeleteProgram(shader.spId);
   }
 }
 
-Texture AppLoadTexture(const char *texPath) {
-  Texture texture = {0};
-  KTX_error_code result = KTX_SUCCESS;
+// Parse a KTX file straight from its mapping, without stdio buffering.
+static KTX_error_code CreateTextureFromFile(const char *texPath,
+                                            ktxTexture **src) {
+  Asset asset = {0};
+  if (!AssetOpen(texPath, ASSET_READ_SEQUENTIAL, &asset)) {
+    return KTX_FILE_OPEN_FAILED;
+  }
 
-  result = ktxTexture_CreateFromNamedFile(
-      texPath, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &texture.src);
+  AppTimerBegin("load");
+  KTX_error_code result = ktxTexture_CreateFromMemory(
+      asset.data, asset.size, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, src);
+  AssetClose(&asset);
+  AppTimerEnd();
   if (result != KTX_SUCCESS) {
-    // TODO(cedmundo): Handle KTX_* errors
+    return result;
+  }
+
+  // Basis payloads are transcoded here so it happens on the calling worker
+  if ((*src)->classId == ktxTexture2_c &&
+      ktxTexture2_NeedsTranscoding((ktxTexture2 *)*src)) {
+    AppTimerBegin("transcode");
+    result =
+        ktxTexture2_TranscodeBasis((ktxTexture2 *)*src, app.transcodeFormat, 0);
+    AppTimerEnd();
+    if (result != KTX_SUCCESS) {
+      ktxTexture_Destroy(*src);
+      *src = NULL;
+    }
+  }
+
+  return result;
+}
+
+// Take a free slot for path, returns its index or -1 when out of memory.
+static int AllocTextureSlot(const char *texPath) {
+  unsigned index = 0;
+
+  pthread_mutex_lock(&app.loadLock);
+  while (index < app.slotCount && app.slots[index].state != SLOT_FREE) {
+    index++;
+  }
+
+  if (index == app.slotCount) {
+    unsigned slotCount = app.slotCount == 0 ? 16 : app.slotCount * 2;
+    TextureSlot *slots = realloc(app.slots, slotCount * sizeof(TextureSlot));
+    if (slots == NULL) {
+      pthread_mutex_unlock(&app.loadLock);
+      return -1;
+    }
+
+    memset(slots + app.slotCount, 0,
+           (slotCount - app.slotCount) * sizeof(TextureSlot));
+    app.slots = slots;
+    app.slotCount = slotCount;
+  }
+
+  TextureSlot *slot = &app.slots[index];
+  *slot = (TextureSlot){0};
+  slot->state = SLOT_QUEUED;
+  slot->status = E_TEXTURE_PENDING;
+  slot->path = strdup(texPath);
+  slot->lastUse = app.frame;
+  pthread_mutex_unlock(&app.loadLock);
+  return (int)index;
+}
+
+// Memory records of slot sources are keyed by slot number.
+static uintptr_t SlotHandle(const TextureSlot *slot) {
+  return (uintptr_t)(slot - app.slots) + 1;
+}
+
+// Free the CPU copy of the image, it is read again from file when needed.
+static void DropTextureSource(TextureSlot *slot) {
+  MemoryUntrack(MEMORY_CPU_TEXTURE, SlotHandle(slot));
+  if (slot->src != NULL) {
+    ktxTexture_Destroy(slot->src);
+    slot->src = NULL;
+  }
+
+  AssetClose(&slot->asset);
+  free(slot->image.mipmaps);
+  free(slot->image.offsets);
+  slot->image = (TextureImage){0};
+  slot->cpuBytes = 0;
+}
+
+// Check if a slot still holds the data needed to upload it again.
+static bool HasTextureSource(const TextureSlot *slot) {
+  return slot->src != NULL || slot->image.data != NULL;
+}
+
+// Bytes of every image of a texture, as they are uploaded.
+static size_t TextureImageSize(const TextureImage *image) {
+  size_t size = 0;
+  for (unsigned level = 0; level < image->levels; level++) {
+    size += image->levelSizes[level] * image->layers * image->faces;
+  }
+
+  return size;
+}
+
+// Account an uploaded slot, its source is kept only if there is a CPU budget.
+static void FinishTextureSlot(TextureSlot *slot, StatusCode status) {
+  // Cached payloads have no ktxTexture, only their image description
+  const TextureImage *image = &slot->image;
+  size_t dataSize = image->streamable ? TextureImageSize(image)
+                                      : ktxTexture_GetDataSize(slot->src);
+  bool generateMipmaps =
+      image->streamable ? image->generateMipmaps : slot->src->generateMipmaps;
+  slot->gpuBytes = status == SUCCESS ? dataSize : 0;
+  if (status == SUCCESS && generateMipmaps) {
+    slot->gpuBytes += dataSize / 3;
+  }
+
+  unsigned levels = image->streamable ? image->levels : slot->src->numLevels;
+  if (status == SUCCESS) {
+    MemoryTrack(MEMORY_GPU_TEXTURE, slot->id, slot->gpuBytes, levels,
+                image->internalFormat, slot->path);
+  }
+
+  if (app.cpuBudget == 0 || status != SUCCESS) {
+    DropTextureSource(slot);
+  } else {
+    slot->cpuBytes = dataSize;
+  }
+
+  pthread_mutex_lock(&app.loadLock);
+  slot->status = status;
+  slot->state = status == SUCCESS ? SLOT_READY : SLOT_FAILED;
+  pthread_mutex_unlock(&app.loadLock);
+}
+
+// Upload a slot decoded on the calling thread in one go.
+static Texture FinishTextureLoad(int index) {
+  Texture texture = {.status = E_CANNOT_CREATE_TEXTURE};
+  if (index < 0) {
+    return texture;
+  }
+
+  TextureSlot *slot = &app.slots[index];
+  pthread_mutex_lock(&app.loadLock);
+  bool decoded = slot->state == SLOT_DECODED;
+  if (!decoded) {
     // TODO(cedmundo): Report log error
+    ReleaseTextureSlot(slot);
+  }
+  pthread_mutex_unlock(&app.loadLock);
+  if (!decoded) {
+    return texture;
+  }
+
+  glGenTextures(1, &slot->id);
+  AppTimerBegin("upload");
+  UploadTextureSlot(slot, SIZE_MAX);
+  AppTimerEnd();
+
+  texture.status = slot->status;
+  texture.id = slot->id;
+  texture.slot = index + 1;
+  texture.format = slot->target;
+  return texture;
+}
+
+Texture AppLoadTexture(const char *texPath) {
+  assert(texPath != NULL && "invalid arg texPath: cannot be NULL");
+  return CacheLoadTexture(texPath, 0);
+}
+
+Texture CacheLoadTexture(const char *texPath, uint64_t sourceHash) {
+  assert(texPath != NULL && "invalid arg texPath: cannot be NULL");
+  int index = AllocTextureSlot(texPath);
+  if (index >= 0) {
+    // Nothing else sees the slot until it is returned
+    app.slots[index].sourceHash = sourceHash;
+    DecodeTextureJob((void *)(uintptr_t)index);
+  }
+
+  return FinishTextureLoad(index);
+}
+
+typedef struct {
+  const char *path;
+  ktxTexture *src;
+  KTX_error_code result;
+} TextureBatchItem;
+
+static void DecodeTextureBatchJob(void *arg) {
+  TextureBatchItem *item = arg;
+  item->result = CreateTextureFromFile(item->path, &item->src);
+}
+
+bool AppLoadTextures(const char **texPaths, int count, Texture *textures) {
+  assert(texPaths != NULL && "invalid arg texPaths: cannot be NULL");
+  assert(textures != NULL && "invalid arg textures: cannot be NULL");
+  int *indices = calloc(count, sizeof(int));
+  if (indices == NULL) {
+    return false;
+  }
+
+  // Decode in parallel, then upload each one on this thread
+  for (int i = 0; i < count; i++) {
+    indices[i] = AllocTextureSlot(texPaths[i]);
+  }
+
+  JobGroup group = {0};
+  for (int i = 0; i < count; i++) {
+    if (indices[i] >= 0) {
+      JobsSubmit(DecodeTextureJob, (void *)(uintptr_t)indices[i], &group);
+    }
+  }
+  JobsWait(&group);
+
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    textures[i] = FinishTextureLoad(indices[i]);
+    ok = ok && textures[i].status == SUCCESS;
+  }
+
+  free(indices);
+  return ok;
+}
+
+// Find the GL formats of a KTX2 texture, false if it has no known mapping.
+static bool MapVkFormat(ktxTexture2 *src, TextureImage *image) {
+  size_t count = sizeof(formatMappings) / sizeof(formatMappings[0]);
+  for (size_t i = 0; i < count; i++) {
+    if (formatMappings[i].vkFormat == src->vkFormat) {
+      image->internalFormat = formatMappings[i].internalFormat;
+      image->format = formatMappings[i].format;
+      image->type = formatMappings[i].type;
+      image->compressed = formatMappings[i].type == 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Fill image with the layout of src data, only 2D textures with known formats
+// can be uploaded piecewise, others fall back to ktxTexture_GLUpload.
+static void DescribeTextureImage(ktxTexture *src, TextureImage *image) {
+  *image = (TextureImage){0};
+  if (src->numDimensions != 2 || (src->isCubemap && src->isArray) ||
+      src->numLevels > MAX_TEXTURE_LEVELS) {
+    return;
+  }
+
+  if (src->classId == ktxTexture1_c) {
+    ktxTexture1 *src1 = (ktxTexture1 *)src;
+    image->internalFormat = src1->glInternalformat;
+    image->format = src1->glFormat;
+    image->type = src1->glType;
+    image->compressed = src->isCompressed;
+    image->unpackAlignment = 4;
+  } else if (MapVkFormat((ktxTexture2 *)src, image)) {
+    // KTX2 rows are tightly packed
+    image->unpackAlignment = 1;
+  } else {
+    return;
+  }
+
+  image->generateMipmaps = src->generateMipmaps;
+  image->target = GL_TEXTURE_2D;
+  if (src->isCubemap) {
+    image->target = GL_TEXTURE_CUBE_MAP;
+  } else if (src->isArray) {
+    image->target = GL_TEXTURE_2D_ARRAY;
+  }
+
+  image->width = src->baseWidth;
+  image->height = src->baseHeight;
+  image->levels = src->numLevels;
+  image->layers = src->numLayers;
+  image->faces = src->numFaces;
+  image->data = ktxTexture_GetData(src);
+
+  unsigned count = image->levels * image->layers * image->faces;
+  image->offsets = calloc(count, sizeof(size_t));
+  if (image->offsets == NULL) {
+    return;
+  }
+
+  unsigned index = 0;
+  for (unsigned level = 0; level < image->levels; level++) {
+    image->levelSizes[level] = ktxTexture_GetImageSize(src, level);
+    for (unsigned layer = 0; layer < image->layers; layer++) {
+      for (unsigned face = 0; face < image->faces; face++) {
+        ktxTexture_GetImageOffset(src, level, layer, face,
+                                  &image->offsets[index]);
+        index += 1;
+      }
+    }
+  }
+
+  image->streamable = true;
+}
+
+static uint32_t ReadU32(const unsigned char *data) {
+  uint32_t value = 0;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t ReadU64(const unsigned char *data) {
+  uint64_t value = 0;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Point image offsets at the images inside a KTX1 file. Non-array cubemaps
+// store each face padded, everything else stores the level images packed.
+static bool LocateKTX1Images(const Asset *asset, TextureImage *image,
+                             bool isArray) {
+  const unsigned char *data = asset->data;
+  if (asset->size < 64 || ReadU32(data + 12) != 0x04030201) {
+    return false;
+  }
+
+  bool paddedFaces = image->faces == 6 && !isArray;
+  size_t offset = 64 + (size_t)ReadU32(data + 60);
+  for (unsigned level = 0; level < image->levels; level++) {
+    if (offset + 4 > asset->size) {
+      return false;
+    }
+
+    size_t imageSize = ReadU32(data + offset);
+    size_t faceStride = (imageSize + 3) & ~(size_t)3;
+    size_t perImage = image->levelSizes[level];
+    offset += 4;
+    if (paddedFaces ? imageSize != perImage
+                    : imageSize != perImage * image->layers * image->faces) {
+      return false;
+    }
+
+    for (unsigned layer = 0; layer < image->layers; layer++) {
+      for (unsigned face = 0; face < image->faces; face++) {
+        unsigned index = (level * image->layers + layer) * image->faces + face;
+        size_t imageOffset = paddedFaces
+                                 ? offset + face * faceStride
+                                 : offset + (layer * image->faces + face) *
+                                                perImage;
+        if (imageOffset + perImage > asset->size) {
+          return false;
+        }
+        image->offsets[index] = imageOffset;
+      }
+    }
+
+    offset += paddedFaces ? 6 * faceStride : imageSize;
+    offset = (offset + 3) & ~(size_t)3;
+  }
+
+  return true;
+}
+
+// Point image offsets at the images inside a KTX2 file using its level index,
+// only valid when levels are not supercompressed.
+static bool LocateKTX2Images(const Asset *asset, TextureImage *image) {
+  const unsigned char *data = asset->data;
+  for (unsigned level = 0; level < image->levels; level++) {
+    size_t entry = 80 + level * 24;
+    if (entry + 24 > asset->size) {
+      return false;
+    }
+
+    uint64_t levelOffset = ReadU64(data + entry);
+    uint64_t levelLength = ReadU64(data + entry + 8);
+    size_t perImage = image->levelSizes[level];
+    if (perImage * image->layers * image->faces > levelLength ||
+        levelOffset + levelLength > asset->size) {
+      return false;
+    }
+
+    for (unsigned layer = 0; layer < image->layers; layer++) {
+      for (unsigned face = 0; face < image->faces; face++) {
+        unsigned index = (level * image->layers + layer) * image->faces + face;
+        image->offsets[index] =
+            levelOffset + (layer * image->faces + face) * perImage;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Parse only the metadata of a KTX file and describe its images in place, so
+// each level is read from the mapping when it is uploaded. Fails for files
+// that need inflating or transcoding first.
+static bool DescribeMappedTexture(const char *texPath, Asset *asset,
+                                  ktxTexture **src, TextureImage *image) {
+  if (!AssetOpen(texPath, ASSET_READ_SEQUENTIAL, asset)) {
+    return false;
+  }
+
+  KTX_error_code result = ktxTexture_CreateFromMemory(
+      asset->data, asset->size, KTX_TEXTURE_CREATE_NO_FLAGS, src);
+  bool located = false;
+  if (result == KTX_SUCCESS) {
+    DescribeTextureImage(*src, image);
+    if (!image->streamable) {
+      located = false;
+    } else if ((*src)->classId == ktxTexture1_c) {
+      located = LocateKTX1Images(asset, image, (*src)->isArray);
+    } else {
+      ktxTexture2 *src2 = (ktxTexture2 *)*src;
+      located = src2->supercompressionScheme == KTX_SS_NONE &&
+                !ktxTexture2_NeedsTranscoding(src2) &&
+                LocateKTX2Images(asset, image);
+    }
+  }
+
+  if (!located) {
+    if (*src != NULL) {
+      ktxTexture_Destroy(*src);
+      *src = NULL;
+    }
+    free(image->offsets);
+    *image = (TextureImage){0};
+    AssetClose(asset);
+    return false;
+  }
+
+  image->data = asset->data;
+  return true;
+}
+
+#define TEXTURE_CACHE_MAGIC 0x43544b53u // "SKTC"
+#define TEXTURE_CACHE_VERSION 1
+
+// Header of a cached texture payload, followed by every image in upload
+// order: by level, then layer, then face.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t target;
+  uint32_t internalFormat;
+  uint32_t format;
+  uint32_t type;
+  uint32_t compressed;
+  uint32_t generateMipmaps;
+  uint32_t unpackAlignment;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levels;
+  uint32_t layers;
+  uint32_t faces;
+  uint64_t levelSizes[MAX_TEXTURE_LEVELS];
+} TextureCacheHeader;
+
+// Payloads depend on the source bytes, on the format Basis data becomes and on
+// whether missing mip chains are generated. The source is hashed only when
+// sourceHash is 0 and caching is enabled, 0 is returned otherwise.
+static uint64_t TextureCacheKey(const char *texPath, uint64_t *sourceHash) {
+  if (!AssetCacheEnabled()) {
+    return 0;
+  }
+
+  if (*sourceHash == 0) {
+    Asset source = {0};
+    if (!AssetOpen(texPath, ASSET_READ_SEQUENTIAL, &source)) {
+      return 0;
+    }
+
+    *sourceHash = AssetHash(ASSET_HASH_SEED, source.data, source.size);
+    AssetClose(&source);
+  }
+
+  uint64_t key = AssetHash(*sourceHash, &app.transcodeInternalFormat,
+                           sizeof(app.transcodeInternalFormat));
+  key = AssetHash(key, &app.generateMipmaps, sizeof(app.generateMipmaps));
+  return key;
+}
+
+// Describe the images of a cached payload in place, so it uploads straight
+// from the mapping. key is set for storing the payload when there is none.
+static bool DescribeCachedTexture(const char *texPath, uint64_t *sourceHash,
+                                  Asset *asset, TextureImage *image,
+                                  uint64_t *key) {
+  char path[PATH_MAX];
+  *key = TextureCacheKey(texPath, sourceHash);
+  if (*key == 0 || !AssetCachePath(*key, "tex", path, sizeof(path))) {
+    *key = 0;
+    return false;
+  }
+
+  if (!AssetOpen(path, ASSET_READ_SEQUENTIAL, asset)) {
+    return false;
+  }
+
+  const TextureCacheHeader *header = (const TextureCacheHeader *)asset->data;
+  bool valid = asset->size >= sizeof(TextureCacheHeader) &&
+               header->magic == TEXTURE_CACHE_MAGIC &&
+               header->version == TEXTURE_CACHE_VERSION &&
+               header->key == *key && header->levels > 0 &&
+               header->levels <= MAX_TEXTURE_LEVELS && header->layers > 0 &&
+               (header->faces == 1 || header->faces == 6);
+  unsigned count = valid ? header->levels * header->layers * header->faces : 0;
+  image->offsets = valid ? calloc(count, sizeof(size_t)) : NULL;
+  if (image->offsets == NULL) {
+    AssetClose(asset);
+    return false;
+  }
+
+  size_t offset = sizeof(TextureCacheHeader);
+  for (unsigned index = 0; index < count; index++) {
+    unsigned level = index / (header->layers * header->faces);
+    image->levelSizes[level] = header->levelSizes[level];
+    image->offsets[index] = offset;
+    offset += header->levelSizes[level];
+  }
+
+  // A truncated file is ignored and written again
+  if (offset > asset->size) {
+    free(image->offsets);
+    *image = (TextureImage){0};
+    AssetClose(asset);
+    return false;
+  }
+
+  image->streamable = true;
+  image->target = header->target;
+  image->internalFormat = header->internalFormat;
+  image->format = header->format;
+  image->type = header->type;
+  image->compressed = header->compressed != 0;
+  image->generateMipmaps = header->generateMipmaps != 0;
+  image->unpackAlignment = (int)header->unpackAlignment;
+  image->width = header->width;
+  image->height = header->height;
+  image->levels = header->levels;
+  image->layers = header->layers;
+  image->faces = header->faces;
+  image->data = asset->data;
+  return true;
+}
+
+// Save the GPU ready images of a texture so later loads skip decoding.
+static void StoreCachedTexture(uint64_t key, const TextureImage *image) {
+  char path[PATH_MAX];
+  if (!image->streamable || !AssetCachePath(key, "tex", path, sizeof(path))) {
+    return;
+  }
+
+  size_t size = sizeof(TextureCacheHeader) + TextureImageSize(image);
+  unsigned char *data = malloc(size);
+  if (data == NULL) {
+    return;
+  }
+
+  TextureCacheHeader header = {
+      .magic = TEXTURE_CACHE_MAGIC,
+      .version = TEXTURE_CACHE_VERSION,
+      .key = key,
+      .target = image->target,
+      .internalFormat = image->internalFormat,
+      .format = image->format,
+      .type = image->type,
+      .compressed = image->compressed,
+      .generateMipmaps = image->generateMipmaps,
+      .unpackAlignment = (uint32_t)image->unpackAlignment,
+      .width = image->width,
+      .height = image->height,
+      .levels = image->levels,
+      .layers = image->layers,
+      .faces = image->faces,
+  };
+  for (unsigned level = 0; level < image->levels; level++) {
+    header.levelSizes[level] = image->levelSizes[level];
+  }
+  memcpy(data, &header, sizeof(header));
+
+  size_t offset = sizeof(header);
+  unsigned count = image->levels * image->layers * image->faces;
+  for (unsigned index = 0; index < count; index++) {
+    size_t levelSize =
+        image->levelSizes[index / (image->layers * image->faces)];
+    memcpy(data + offset, image->data + image->offsets[index], levelSize);
+    offset += levelSize;
+  }
+
+  AppTimerBegin("cache");
+  if (!AssetWrite(path, data, size)) {
+    fprintf(stderr, "cannot write texture cache %s\n", path);
+  }
+  AppTimerEnd();
+  free(data);
+}
+
+// Check if the CPU can build the mip chain of a texture, only single level
+// RGBA8 images are supported.
+static bool CanGenerateMipmaps(const TextureImage *image) {
+  return image->streamable && image->levels == 1 && !image->compressed &&
+         image->format == GL_RGBA && image->type == GL_UNSIGNED_BYTE &&
+         (image->internalFormat == GL_RGBA8 ||
+          image->internalFormat == GL_SRGB8_ALPHA8) &&
+         (image->width > 1 || image->height > 1);
+}
+
+// Check if a texture is missing a mip chain the CPU should build.
+static bool WantsMipmaps(const TextureImage *image) {
+  return (image->generateMipmaps || app.generateMipmaps) &&
+         CanGenerateMipmaps(image);
+}
+
+// Build the mip chain of a texture on the CPU, the image then points at a copy
+// holding every level. Returns false if there is no memory for it.
+static bool GenerateTextureMipmaps(TextureImage *image) {
+  unsigned levels = MipmapLevelCount(image->width, image->height);
+  unsigned perLevel = image->layers * image->faces;
+  size_t *offsets = calloc(levels * perLevel, sizeof(size_t));
+  size_t levelSizes[MAX_TEXTURE_LEVELS] = {0};
+  size_t size = 0;
+  for (unsigned level = 0; level < levels; level++) {
+    unsigned width = image->width >> level ? image->width >> level : 1;
+    unsigned height = image->height >> level ? image->height >> level : 1;
+    levelSizes[level] = (size_t)width * height * 4;
+    for (unsigned i = 0; offsets != NULL && i < perLevel; i++) {
+      offsets[level * perLevel + i] = size;
+      size += levelSizes[level];
+    }
+  }
+
+  unsigned char *data = offsets != NULL ? malloc(size) : NULL;
+  if (data == NULL) {
+    free(offsets);
+    return false;
+  }
+
+  for (unsigned i = 0; i < perLevel; i++) {
+    memcpy(data + offsets[i], image->data + image->offsets[i], levelSizes[0]);
+  }
+
+  AppTimerBegin("mipmap");
+  MipmapGenerate(data, offsets, levels, perLevel, image->width, image->height,
+                 image->internalFormat == GL_SRGB8_ALPHA8);
+  AppTimerEnd();
+
+  free(image->mipmaps);
+  free(image->offsets);
+  image->mipmaps = data;
+  image->data = data;
+  image->offsets = offsets;
+  image->levels = levels;
+  image->generateMipmaps = false;
+  memcpy(image->levelSizes, levelSizes, sizeof(levelSizes));
+  return true;
+}
+
+// Read and parse a KTX file on a worker thread.
+static void DecodeTextureJob(void *arg) {
+  unsigned index = (unsigned)(uintptr_t)arg;
+  char *path = NULL;
+  ktxTexture *src = NULL;
+  Asset asset = {0};
+  TextureImage image = {0};
+  StatusCode status = SUCCESS;
+
+  // The path string is never changed while the slot is queued, the source
+  // hash is kept for reloads after eviction
+  pthread_mutex_lock(&app.loadLock);
+  path = app.slots[index].path;
+  uint64_t sourceHash = app.slots[index].sourceHash;
+  pthread_mutex_unlock(&app.loadLock);
+
+  // Prefer streaming levels from the file or from a cached payload of it,
+  // inflate or transcode everything otherwise and cache the result
+  uint64_t key = 0;
+  bool decoded = false;
+  bool mapped = DescribeMappedTexture(path, &asset, &src, &image);
+  if (mapped && WantsMipmaps(&image)) {
+    // A cached payload of a mapped file already has the generated levels
+    Asset cached = {0};
+    TextureImage cachedImage = {0};
+    if (DescribeCachedTexture(path, &sourceHash, &cached, &cachedImage,
+                              &key)) {
+      ktxTexture_Destroy(src);
+      src = NULL;
+      free(image.offsets);
+      AssetClose(&asset);
+      asset = cached;
+      image = cachedImage;
+    }
+  } else if (!mapped &&
+             !DescribeCachedTexture(path, &sourceHash, &asset, &image, &key)) {
+    KTX_error_code result = CreateTextureFromFile(path, &src);
+    if (result != KTX_SUCCESS) {
+      // TODO(cedmundo): Report log error
+      status = E_CANNOT_CREATE_TEXTURE;
+    } else {
+      DescribeTextureImage(src, &image);
+      decoded = true;
+    }
+  }
+
+  bool generated = status == SUCCESS && WantsMipmaps(&image) &&
+                   GenerateTextureMipmaps(&image);
+  if ((decoded || generated) && key != 0) {
+    StoreCachedTexture(key, &image);
+  }
+
+  // Uploads read the mapping on the render thread, its pages are faulted in
+  // here so the frame never waits on the disk
+  if (status == SUCCESS && image.streamable && image.data == asset.data) {
+    AssetPageIn(&asset);
+  }
+
+  // Sources are tracked from decoding until they are dropped
+  if (status == SUCCESS) {
+    size_t bytes = image.streamable ? TextureImageSize(&image)
+                                    : ktxTexture_GetDataSize(src);
+    unsigned levels = image.streamable ? image.levels : src->numLevels;
+    MemoryTrack(MEMORY_CPU_TEXTURE, index + 1, bytes, levels,
+                image.internalFormat, path);
+  }
+
+  pthread_mutex_lock(&app.loadLock);
+  TextureSlot *slot = &app.slots[index];
+  slot->sourceHash = sourceHash;
+  slot->src = src;
+  slot->asset = asset;
+  slot->image = image;
+  slot->status = status;
+  if (slot->state == SLOT_CANCELLED) {
+    ReleaseTextureSlot(slot);
+  } else {
+    slot->state = status == SUCCESS ? SLOT_DECODED : SLOT_FAILED;
+  }
+  pthread_mutex_unlock(&app.loadLock);
+}
+
+Texture AppLoadTextureAsync(const char *texPath) {
+  assert(texPath != NULL && "invalid arg texPath: cannot be NULL");
+  Texture texture = {0};
+
+  int index = AllocTextureSlot(texPath);
+  if (index < 0) {
     texture.status = E_CANNOT_CREATE_TEXTURE;
     return texture;
   }
 
-  // upload to GPU
+  // The GL name exists right away so it can be assigned to models, workers
+  // never touch it. Its target is unknown until the file is parsed
+  glGenTextures(1, &app.slots[index].id);
+  texture.id = app.slots[index].id;
+  texture.slot = index + 1;
+  texture.status = SUCCESS;
+
+  JobsSubmit(DecodeTextureJob, (void *)(uintptr_t)index, NULL);
+  return texture;
+}
+
+StatusCode AppGetTextureStatus(Texture texture) {
+  if (texture.slot == 0 || texture.status != SUCCESS) {
+    return texture.status;
+  }
+
+  pthread_mutex_lock(&app.loadLock);
+  StatusCode status = app.slots[texture.slot - 1].status;
+  pthread_mutex_unlock(&app.loadLock);
+  return status;
+}
+
+void AppSetTextureUploadBudget(size_t bytesPerFrame) {
+  app.uploadBudget = bytesPerFrame;
+}
+
+void AppSetTextureBudget(size_t cpuBytes, size_t gpuBytes) {
+  app.cpuBudget = cpuBytes;
+  app.gpuBudget = gpuBytes;
+}
+
+void AppSetMipmapGeneration(bool enabled) { app.generateMipmaps = enabled; }
+
+static const unsigned char ktx1Identifier[12] = {
+    0xab, 'K', 'T', 'X', ' ', '1', '1', 0xbb, '\r', '\n', 0x1a, '\n',
+};
+
+// Write the images of an RGBA8 texture as a KTX1 file, rows of 4 byte pixels
+// need no padding.
+static bool WriteKTX1(const char *path, const TextureImage *image) {
+  bool isArray = image->target == GL_TEXTURE_2D_ARRAY;
+  bool cubemap = image->faces == 6 && !isArray;
+  unsigned perLevel = image->layers * image->faces;
+  size_t size = 64;
+  for (unsigned level = 0; level < image->levels; level++) {
+    size += 4 + image->levelSizes[level] * perLevel;
+  }
+
+  unsigned char *data = malloc(size);
+  if (data == NULL) {
+    return false;
+  }
+
+  uint32_t header[13] = {
+      0x04030201,
+      image->type,
+      1, // type size of GL_UNSIGNED_BYTE
+      image->format,
+      image->internalFormat,
+      image->format,
+      image->width,
+      image->height,
+      0,
+      isArray ? image->layers : 0,
+      image->faces,
+      image->levels,
+      0,
+  };
+  memcpy(data, ktx1Identifier, sizeof(ktx1Identifier));
+  memcpy(data + sizeof(ktx1Identifier), header, sizeof(header));
+
+  // Non-array cubemaps give the size of one face, the rest of whole levels
+  size_t offset = 64;
+  for (unsigned level = 0; level < image->levels; level++) {
+    size_t levelSize = image->levelSizes[level];
+    uint32_t imageSize = (uint32_t)(cubemap ? levelSize : levelSize * perLevel);
+    memcpy(data + offset, &imageSize, sizeof(imageSize));
+    offset += sizeof(imageSize);
+    for (unsigned i = 0; i < perLevel; i++) {
+      memcpy(data + offset,
+             image->data + image->offsets[level * perLevel + i], levelSize);
+      offset += levelSize;
+    }
+  }
+
+  bool written = AssetWrite(path, data, size);
+  free(data);
+  return written;
+}
+
+bool AppWriteMipmappedKTX(const char *srcPath, const char *dstPath) {
+  assert(srcPath != NULL && "invalid arg srcPath: cannot be NULL");
+  assert(dstPath != NULL && "invalid arg dstPath: cannot be NULL");
+  ktxTexture *src = NULL;
+  TextureImage image = {0};
+  bool written = false;
+  if (CreateTextureFromFile(srcPath, &src) != KTX_SUCCESS) {
+    goto terminate;
+  }
+
+  DescribeTextureImage(src, &image);
+  if (CanGenerateMipmaps(&image) && !GenerateTextureMipmaps(&image)) {
+    goto terminate;
+  }
+
+  // Textures that already have a mip chain are written as they are
+  if (!image.streamable || image.compressed || image.format != GL_RGBA ||
+      image.type != GL_UNSIGNED_BYTE) {
+    goto terminate;
+  }
+
+  written = WriteKTX1(dstPath, &image);
+
+terminate:
+  free(image.mipmaps);
+  free(image.offsets);
+  if (src != NULL) {
+    ktxTexture_Destroy(src);
+  }
+  return written;
+}
+
+// Allocate every level of the texture without data, images come later.
+static void AllocTextureStorage(const TextureImage *image) {
+  for (unsigned level = 0; level < image->levels; level++) {
+    unsigned width = image->width >> level ? image->width >> level : 1;
+    unsigned height = image->height >> level ? image->height >> level : 1;
+    for (unsigned face = 0; face < image->faces; face++) {
+      GLenum target = image->target;
+      if (target == GL_TEXTURE_CUBE_MAP) {
+        target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+      }
+
+      if (image->target == GL_TEXTURE_2D_ARRAY && image->compressed) {
+        glCompressedTexImage3D(target, level, image->internalFormat, width,
+                               height, image->layers, 0,
+                               image->levelSizes[level] * image->layers, NULL);
+      } else if (image->target == GL_TEXTURE_2D_ARRAY) {
+        glTexImage3D(target, level, image->internalFormat, width, height,
+                     image->layers, 0, image->format, image->type, NULL);
+      } else if (image->compressed) {
+        glCompressedTexImage2D(target, level, image->internalFormat, width,
+                               height, 0, image->levelSizes[level], NULL);
+      } else {
+        glTexImage2D(target, level, image->internalFormat, width, height, 0,
+                     image->format, image->type, NULL);
+      }
+    }
+  }
+
+  if (image->generateMipmaps) {
+    return;
+  }
+
+  // Levels stream in from the smallest, only those are sampled meanwhile
+  glTexParameteri(image->target, GL_TEXTURE_BASE_LEVEL, image->levels - 1);
+  glTexParameteri(image->target, GL_TEXTURE_MAX_LEVEL, image->levels - 1);
+  if (image->levels == 1) {
+    glTexParameteri(image->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  }
+}
+
+// Copy one image through the pixel buffer object and upload it from there.
+static void UploadTextureImage(const TextureImage *image, unsigned index) {
+  unsigned face = index % image->faces;
+  unsigned layer = image->firstLayer + (index / image->faces) % image->layers;
+  unsigned level = index / (image->faces * image->layers);
+  unsigned width = image->width >> level ? image->width >> level : 1;
+  unsigned height = image->height >> level ? image->height >> level : 1;
+  size_t size = image->levelSizes[level];
+  const unsigned char *pixels = image->data + image->offsets[index];
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, app.uploadPBO);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+  void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size,
+                                  GL_MAP_WRITE_BIT |
+                                      GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (mapped != NULL) {
+    memcpy(mapped, pixels, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    pixels = NULL;
+  } else {
+    // Mapping failed, upload straight from client memory
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  GLenum target = image->target;
+  if (target == GL_TEXTURE_CUBE_MAP) {
+    target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+  }
+
+  if (image->target == GL_TEXTURE_2D_ARRAY && image->compressed) {
+    glCompressedTexSubImage3D(target, level, 0, 0, layer, width, height, 1,
+                              image->internalFormat, size, pixels);
+  } else if (image->target == GL_TEXTURE_2D_ARRAY) {
+    glTexSubImage3D(target, level, 0, 0, layer, width, height, 1,
+                    image->format, image->type, pixels);
+  } else if (image->compressed) {
+    glCompressedTexSubImage2D(target, level, 0, 0, width, height,
+                              image->internalFormat, size, pixels);
+  } else {
+    glTexSubImage2D(target, level, 0, 0, width, height, image->format,
+                    image->type, pixels);
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Upload as many images of a decoded slot as the budget allows, at least one
+// so images larger than the budget still make progress. Levels go from the
+// smallest to the largest and each one becomes the base level once complete,
+// so the texture is usable after its first frame. Returns bytes used.
+static size_t UploadTextureSlot(TextureSlot *slot, size_t budget) {
+  TextureImage *image = &slot->image;
+  size_t uploaded = 0;
   GLenum glError = 0;
-  glGenTextures(1, &texture.id);
-  result =
-      ktxTexture_GLUpload(texture.src, &texture.id, &texture.format, &glError);
-  if (result != KTX_SUCCESS) {
-    // TODO(cedmundo): Handle KTX_* errors and glError
-    // TODO(cedmundo): Report log error
-    texture.status = E_CANNOT_UPLOAD_TEXTURE;
+
+  if (!image->streamable) {
+    KTX_error_code result =
+        ktxTexture_GLUpload(slot->src, &slot->id, &slot->target, &glError);
+    uploaded = ktxTexture_GetDataSize(slot->src);
+    FinishTextureSlot(slot, result == KTX_SUCCESS ? SUCCESS
+                                                  : E_CANNOT_UPLOAD_TEXTURE);
+    return uploaded;
+  }
+
+  if (app.uploadPBO == 0) {
+    glGenBuffers(1, &app.uploadPBO);
+  }
+
+  glBindTexture(image->target, slot->id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, image->unpackAlignment);
+  if (slot->state == SLOT_DECODED) {
+    slot->target = image->target;
+    AllocTextureStorage(image);
+    slot->state = SLOT_UPLOADING;
+  }
+
+  unsigned perLevel = image->layers * image->faces;
+  unsigned count = image->levels * perLevel;
+  while (slot->nextImage < count) {
+    unsigned level = image->levels - 1 - slot->nextImage / perLevel;
+    size_t size = image->levelSizes[level];
+    if (uploaded > 0 && uploaded + size > budget) {
+      break;
+    }
+
+    UploadTextureImage(image, level * perLevel + slot->nextImage % perLevel);
+    uploaded += size;
+    slot->nextImage += 1;
+    if (slot->nextImage % perLevel == 0 && !image->generateMipmaps) {
+      glTexParameteri(image->target, GL_TEXTURE_BASE_LEVEL, level);
+    }
+  }
+
+  if (slot->nextImage == count) {
+    if (image->generateMipmaps) {
+      glGenerateMipmap(image->target);
+    }
+
+    FinishTextureSlot(slot, SUCCESS);
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(slot->target, 0);
+  return uploaded;
+}
+
+static void PumpTextureUploads() {
+  size_t uploaded = 0;
+  AppTimerBegin("upload");
+  for (unsigned i = 0; i < app.slotCount && uploaded < app.uploadBudget; i++) {
+    // Only this thread moves a slot past SLOT_DECODED
+    pthread_mutex_lock(&app.loadLock);
+    SlotState state = app.slots[i].state;
+    pthread_mutex_unlock(&app.loadLock);
+
+    if (state == SLOT_DECODED || state == SLOT_UPLOADING) {
+      uploaded += UploadTextureSlot(&app.slots[i], app.uploadBudget - uploaded);
+    }
+  }
+  AppTimerEnd();
+}
+
+// Check that a texture can share an array with the first one packed.
+static bool CanPackImage(const TextureImage *first, const TextureImage *image) {
+  return image->streamable && image->target != GL_TEXTURE_CUBE_MAP &&
+         image->internalFormat == first->internalFormat &&
+         image->format == first->format && image->type == first->type &&
+         image->width == first->width && image->height == first->height &&
+         image->levels == first->levels &&
+         image->generateMipmaps == first->generateMipmaps;
+}
+
+Texture AppPackTextureArray(const char **texPaths, int count,
+                            unsigned *firstLayers) {
+  assert(texPaths != NULL && "invalid arg texPaths: cannot be NULL");
+  assert(count > 0 && "invalid arg count: must be positive");
+  Texture texture = {.format = GL_TEXTURE_2D_ARRAY};
+  TextureBatchItem *items = calloc(count, sizeof(TextureBatchItem));
+  TextureImage *images = calloc(count, sizeof(TextureImage));
+  if (items == NULL || images == NULL) {
+    free(items);
+    free(images);
+    texture.status = E_CANNOT_CREATE_TEXTURE;
     return texture;
   }
 
+  // Files are read and transcoded in parallel, as in AppLoadTextures
+  JobGroup group = {0};
+  for (int i = 0; i < count; i++) {
+    items[i].path = texPaths[i];
+    JobsSubmit(DecodeTextureBatchJob, &items[i], &group);
+  }
+  JobsWait(&group);
+
+  // Files with layers keep them, each one starts after the previous file
+  TextureImage array = {0};
+  for (int i = 0; i < count && texture.status == SUCCESS; i++) {
+    if (items[i].result != KTX_SUCCESS) {
+      texture.status = E_CANNOT_CREATE_TEXTURE;
+      break;
+    }
+
+    DescribeTextureImage(items[i].src, &images[i]);
+    if (i == 0) {
+      array = images[0];
+      array.offsets = NULL;
+      array.layers = 0;
+    }
+
+    if (!CanPackImage(&array, &images[i])) {
+      fprintf(stderr, "cannot pack %s: format or size differs\n",
+              texPaths[i]);
+      texture.status = E_CANNOT_CREATE_TEXTURE;
+      break;
+    }
+
+    images[i].target = GL_TEXTURE_2D_ARRAY;
+    images[i].firstLayer = array.layers;
+    if (firstLayers != NULL) {
+      firstLayers[i] = array.layers;
+    }
+    array.layers += images[i].layers;
+  }
+
+  if (texture.status == SUCCESS) {
+    AppTimerBegin("upload");
+    if (app.uploadPBO == 0) {
+      glGenBuffers(1, &app.uploadPBO);
+    }
+
+    array.target = GL_TEXTURE_2D_ARRAY;
+    glGenTextures(1, &texture.id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture.id);
+    AllocTextureStorage(&array);
+    for (int i = 0; i < count; i++) {
+      // KTX1 rows are padded to 4 bytes, KTX2 ones are not
+      glPixelStorei(GL_UNPACK_ALIGNMENT, images[i].unpackAlignment);
+      unsigned imageCount = images[i].levels * images[i].layers;
+      for (unsigned index = 0; index < imageCount; index++) {
+        UploadTextureImage(&images[i], index);
+      }
+    }
+
+    size_t bytes = TextureImageSize(&array);
+    if (array.generateMipmaps) {
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+      bytes += bytes / 3;
+    } else {
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    }
+    MemoryTrack(MEMORY_GPU_TEXTURE, texture.id, bytes, array.levels,
+                array.internalFormat, texPaths[0]);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    AppTimerEnd();
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (items[i].src != NULL) {
+      ktxTexture_Destroy(items[i].src);
+    }
+    free(images[i].offsets);
+  }
+
+  free(items);
+  free(images);
   return texture;
 }
 
+// Give back the GL memory of a texture, the slot keeps what is needed to
+// upload it again.
+static void EvictTextureSlot(TextureSlot *slot) {
+  MemoryUntrack(MEMORY_GPU_TEXTURE, slot->id);
+  glDeleteTextures(1, &slot->id);
+  slot->id = 0;
+  slot->gpuBytes = 0;
+  slot->nextImage = 0;
+  slot->state = SLOT_EVICTED;
+}
+
+// Find the least recently used slot in state, among those not used on the
+// last frame. Returns NULL if there is none.
+static TextureSlot *FindEvictionVictim(SlotState state, bool needsSource) {
+  TextureSlot *victim = NULL;
+  for (unsigned i = 0; i < app.slotCount; i++) {
+    TextureSlot *slot = &app.slots[i];
+    if (slot->state != state || slot->lastUse + 1 >= app.frame ||
+        (needsSource && !HasTextureSource(slot))) {
+      continue;
+    }
+
+    if (victim == NULL || slot->lastUse < victim->lastUse) {
+      victim = slot;
+    }
+  }
+
+  return victim;
+}
+
+static void EnforceTextureBudget() {
+  size_t gpuBytes = 0;
+  size_t cpuBytes = 0;
+
+  pthread_mutex_lock(&app.loadLock);
+  for (unsigned i = 0; i < app.slotCount; i++) {
+    gpuBytes += app.slots[i].gpuBytes;
+    cpuBytes += app.slots[i].cpuBytes;
+  }
+
+  while (app.gpuBudget != 0 && gpuBytes > app.gpuBudget) {
+    TextureSlot *victim = FindEvictionVictim(SLOT_READY, false);
+    if (victim == NULL) {
+      break;
+    }
+
+    gpuBytes -= victim->gpuBytes;
+    EvictTextureSlot(victim);
+  }
+
+  while (cpuBytes > app.cpuBudget) {
+    TextureSlot *victim = FindEvictionVictim(SLOT_EVICTED, true);
+    if (victim == NULL) {
+      victim = FindEvictionVictim(SLOT_READY, true);
+    }
+
+    if (victim == NULL) {
+      break;
+    }
+
+    cpuBytes -= victim->cpuBytes;
+    DropTextureSource(victim);
+  }
+  pthread_mutex_unlock(&app.loadLock);
+}
+
+// Evicted textures are queued to load again and bound once uploaded.
+unsigned AppUseTexture(Texture texture, GLenum *target) {
+  assert(target != NULL && "invalid arg target: cannot be NULL");
+  if (texture.slot == 0) {
+    *target = texture.format ? texture.format : GL_TEXTURE_2D;
+    return texture.id;
+  }
+
+  unsigned index = texture.slot - 1;
+  TextureSlot *slot = &app.slots[index];
+  bool needsDecode = false;
+
+  pthread_mutex_lock(&app.loadLock);
+  slot->lastUse = app.frame;
+  if (slot->state == SLOT_EVICTED) {
+    glGenTextures(1, &slot->id);
+    needsDecode = !HasTextureSource(slot);
+    slot->state = needsDecode ? SLOT_QUEUED : SLOT_DECODED;
+  }
+  pthread_mutex_unlock(&app.loadLock);
+
+  if (needsDecode) {
+    JobsSubmit(DecodeTextureJob, (void *)(uintptr_t)index, NULL);
+  }
+
+  // Only this thread uploads, so the target cannot change meanwhile
+  *target = slot->target ? slot->target : GL_TEXTURE_2D;
+  return slot->target ? slot->id : 0;
+}
+
+// Free everything held by a slot, app.loadLock must be held by workers.
+static void ReleaseTextureSlot(TextureSlot *slot) {
+  MemoryUntrack(MEMORY_GPU_TEXTURE, slot->id);
+  MemoryUntrack(MEMORY_CPU_TEXTURE, SlotHandle(slot));
+  if (slot->src != NULL) {
+    ktxTexture_Destroy(slot->src);
+  }
+
+  AssetClose(&slot->asset);
+  free(slot->image.mipmaps);
+  free(slot->image.offsets);
+  free(slot->path);
+  *slot = (TextureSlot){0};
+}
+
 void AppDestroyTexture(Texture texture) {
-  if (texture.id != 0) {
-    glDeleteTextures(1, &texture.id);
+  unsigned id = texture.id;
+  if (texture.slot != 0) {
+    pthread_mutex_lock(&app.loadLock);
+    TextureSlot *slot = &app.slots[texture.slot - 1];
+    id = slot->id;
+    if (slot->state == SLOT_QUEUED) {
+      // The worker owns it until decoding ends, its name is deleted below
+      // and may be reused before the worker releases the slot
+      slot->state = SLOT_CANCELLED;
+      slot->id = 0;
+    } else if (slot->state != SLOT_FREE) {
+      ReleaseTextureSlot(slot);
+    }
+    pthread_mutex_unlock(&app.loadLock);
   }
 
-  if (texture.src != NULL) {
-    ktxTexture_Destroy(texture.src);
+  if (id != 0) {
+    MemoryUntrack(MEMORY_GPU_TEXTURE, id);
+    glDeleteTextures(1, &id);
   }
 }
 
 Model AppMakePlane(float dim) {
-  Model model = {0};
-
   // a plane
-  float vertices[] = {
-      // POSITIONS      COLORS            UVS
-      dim,  dim,  0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top right
-      dim,  -dim, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, // bottom right
-      -dim, -dim, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, // bottom left
-      -dim, dim,  0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, // top left
+  float positions[] = {
+      dim,  dim,  0.0f, // top right
+      dim,  -dim, 0.0f, // bottom right
+      -dim, -dim, 0.0f, // bottom left
+      -dim, dim,  0.0f, // top left
+  };
+  float colors[] = {
+      1.0f, 0.0f, 0.0f, // top right
+      0.0f, 1.0f, 0.0f, // bottom right
+      0.0f, 0.0f, 1.0f, // bottom left
+      1.0f, 1.0f, 1.0f, // top left
+  };
+  float uvs[] = {
+      1.0f, 0.0f, // top right
+      1.0f, 1.0f, // bottom right
+      0.0f, 1.0f, // bottom left
+      0.0f, 0.0f, // top left
   };
   unsigned indices[] = {
       0, 1, 3, // first triangle
       1, 2, 3, // second triangle
   };
 
-  // upload model
-  glGenVertexArrays(1, &model.vao);
-  glGenBuffers(1, &model.vbo);
-  glGenBuffers(1, &model.ebo);
-
-  glBindVertexArray(model.vao);
-  glBindBuffer(GL_ARRAY_BUFFER, model.vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
-               GL_STATIC_DRAW);
-
-  // position attribute
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-
-  // color attribute
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-
-  // texture coord attribute
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
-                        (void *)(6 * sizeof(float)));
-  glEnableVertexAttribArray(2);
-
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
-  return model;
+  return AppMakeMesh(&(MeshData){
+      .positions = positions,
+      .colors = colors,
+      .uvs = uvs,
+      .vertexCount = 4,
+      .indices = indices,
+      .indexCount = sizeof(indices) / sizeof(indices[0]),
+  });
 }
 
 void AppRenderModel(Model model) {
@@ -317,11 +2096,18 @@ void AppRenderModel(Model model) {
   //        "invalid arg model.texture: uninitialized texture");
 
   { // draw vertex
-    glBindTexture(GL_TEXTURE_2D, model.texture.id);
+    GLenum target = 0;
+    unsigned texture = AppUseTexture(model.texture, &target);
+    glBindTexture(target, texture);
     glUseProgram(model.shader.spId);
+    BatchLoadViewProjection(model.shader.viewProjLocation);
     glBindVertexArray(model.vao);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.ebo);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    // Array layer goes as a constant attribute, batches stream it instead
+    glDisableVertexAttribArray(LAYER_LOCATION);
+    glVertexAttrib1f(LAYER_LOCATION, (float)model.layer);
+    glDrawElements(GL_TRIANGLES, model.indexCount, model.indexType, 0);
   }
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -334,40 +2120,12 @@ void AppDestroyModel(Model model) {
   }
 
   if (model.vbo != 0) {
+    MemoryUntrack(MEMORY_GPU_BUFFER, model.vbo);
     glDeleteBuffers(1, &model.vbo);
   }
 
   if (model.ebo != 0) {
+    MemoryUntrack(MEMORY_GPU_BUFFER, model.ebo);
     glDeleteBuffers(1, &model.ebo);
   }
 }
-
-char *LoadFileContents(const char *name) {
-  assert(name != NULL && "invalid arg name: cannot be NULL");
-  FILE *file = fopen(name, "re");
-  if (file == NULL) {
-    return NULL;
-  }
-
-  size_t file_size = 0L;
-  assert(fseek(file, 0, SEEK_END) == 0);
-  file_size = ftell(file);
-  assert(fseek(file, 0, SEEK_SET) == 0);
-
-  char *data = calloc(sizeof(char), file_size);
-  size_t read_size = fread(data, sizeof(char), file_size, file);
-  if (read_size == 0) {
-    assert(fclose(file) == 0);
-    free(data);
-    return NULL;
-  }
-
-  return data;
-}
-
-void UnloadFileContents(char *data) {
-  assert(data != NULL && "invalid arg data: cannot be NULL");
-  if (data != NULL) {
-    free(data);
-  }
-}
@@ -1,6 +1,12 @@
 #pragma once
 #include <ktx.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+// Vertex attribute locations shaders use for batched instances, the model
+// transform takes four locations, one per column.
+#define INSTANCE_LOCATION 3
+#define LAYER_LOCATION 7
 
 typedef enum {
   SUCCESS,
@@ -12,29 +18,146 @@ typedef enum {
   E_SHADER_LINK_ERROR,
   E_CANNOT_CREATE_TEXTURE,
   E_CANNOT_UPLOAD_TEXTURE,
+  E_CANNOT_CREATE_MESH,
+  E_CANNOT_START_PIPELINE,
+  E_TEXTURE_PENDING,
   E_ERROR_COUNT,
 } StatusCode;
 
 typedef struct {
   StatusCode status;
   unsigned spId;
+  // Location of the viewProj uniform, looked up once when loaded
+  int viewProjLocation;
 } Shader;
 
 typedef struct {
   StatusCode status;
   unsigned id;
-  ktxTexture *src;
+  unsigned slot;
   GLenum format;
 } Texture;
 
+// Axis aligned box, the bounds of a model in its own space.
+typedef struct {
+  float min[3];
+  float max[3];
+} Bounds;
+
 typedef struct {
+  StatusCode status;
   unsigned vao;
   unsigned vbo;
   unsigned ebo;
+  unsigned indexCount;
+  GLenum indexType;
+  unsigned layer;
+  Bounds bounds;
   Shader shader;
   Texture texture;
 } Model;
 
+// Indexed triangles in full precision, colors and uvs may be NULL.
+// Positions and colors take 3 floats per vertex, uvs 2.
+typedef struct {
+  const float *positions;
+  const float *colors;
+  const float *uvs;
+  unsigned vertexCount;
+  const unsigned *indices;
+  unsigned indexCount;
+} MeshData;
+
+// Percentiles and worst value of a series of timings, in milliseconds.
+typedef struct {
+  int count;
+  float p50;
+  float p95;
+  float p99;
+  float worst;
+} TimingStats;
+
+// Timings of the recent frames, interval is the time between frames, cpu the
+// time between AppBeginFrame and AppEndFrame, gpu the time the GPU spent and
+// latency the time from polling the input a frame used to its presentation.
+typedef struct {
+  TimingStats interval;
+  TimingStats cpu;
+  TimingStats gpu;
+  TimingStats latency;
+} FrameStats;
+
+// Writes the state of the next frame into snapshot, runs on the main thread
+// after events are polled. deltaTime is the time since the previous update.
+typedef void (*AppUpdateFn)(void *user, void *snapshot, float deltaTime);
+
+// Draws a snapshot, runs on the render thread with the GL context current
+// between AppBeginFrame and AppEndFrame.
+typedef void (*AppRenderFn)(void *user, const void *snapshot);
+
+// Update and render run on their own threads and hand frames over through
+// three snapshots of snapshotSize bytes. With dropFrames update runs freely
+// and render always draws the newest snapshot, lowest latency at the cost of
+// updates never drawn; without it update waits until render takes each
+// snapshot, so every update is drawn one frame later.
+typedef struct {
+  AppUpdateFn update;
+  AppRenderFn render;
+  void *user;
+  size_t snapshotSize;
+  bool dropFrames;
+} FramePipeline;
+
+// Kinds of tracked memory, GPU sizes are estimated from formats and sizes.
+typedef enum {
+  MEMORY_GPU_TEXTURE,
+  MEMORY_GPU_BUFFER,
+  MEMORY_GPU_PROGRAM,
+  MEMORY_CPU_TEXTURE,
+  MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+
+#define MEMORY_TOP_COUNT 8
+#define MEMORY_PATH_SIZE 128
+
+// A tracked allocation, levels and internalFormat are 0 when not a texture.
+typedef struct {
+  MemoryCategory category;
+  size_t bytes;
+  unsigned levels;
+  GLenum internalFormat;
+  char path[MEMORY_PATH_SIZE];
+} MemoryRecord;
+
+// Totals per category and the largest allocations, largest first.
+typedef struct {
+  size_t bytes[MEMORY_CATEGORY_COUNT];
+  unsigned count[MEMORY_CATEGORY_COUNT];
+  MemoryRecord top[MEMORY_TOP_COUNT];
+  int topCount;
+} MemoryStats;
+
+// Kinds of streamed data, they differ in how their offsets are aligned.
+typedef enum {
+  STREAM_VERTEX,
+  STREAM_INDEX,
+  STREAM_UNIFORM,
+} StreamUsage;
+
+// Part of the streaming buffer to write data to, draws read it by binding
+// buffer at offset. Valid until AppEndFrame.
+typedef struct {
+  void *data;
+  unsigned buffer;
+  size_t offset;
+  size_t size;
+} StreamSpan;
+
+// Column major 4x4 matrix.
+typedef struct {
+  float m[16];
+} Mat4;
+
 // Exit: Call system exit and prints error if needed.
 int Exit(StatusCode status);
 
@@ -42,35 +165,212 @@ int Exit(StatusCode status);
 StatusCode AppInit(int window_width, int window_height,
                    const char *window_title);
 
+// Startup app with a hidden window, for benchmarks and CI boxes.
+StatusCode AppInitOffscreen(int width, int height);
+
 // Return true if app should be closed.
 bool AppShouldClose();
 
 // Setup the next frame.
 void AppBeginFrame();
 
-// Commit frame and poll events.
+// Present the frame, wait for the frame rate limit and poll events.
 void AppEndFrame();
 
+// Number of vertical blanks to wait when presenting, 0 disables vsync.
+// Defaults to 1, or 0 for offscreen apps.
+void AppSetSwapInterval(int interval);
+
+// Sleep so frames start at most framesPerSecond times per second, 0 removes
+// the limit. Limits the update rate when running a pipeline.
+void AppSetFrameRateLimit(float framesPerSecond);
+
+// Run update and render on separate threads until the window is closed,
+// the GL context belongs to the render thread meanwhile.
+StatusCode AppRunPipeline(const FramePipeline *config);
+
 // Closes the app window and clears all internal data.
 void AppClose();
 
+// Return statistics of the recent frames.
+FrameStats AppGetFrameStats();
+
+// Return statistics of a named timer, count is 0 if it never ran.
+TimingStats AppGetTimerStats(const char *name);
+
+// Start a named timer on the calling thread, timers can be nested.
+void AppTimerBegin(const char *name);
+
+// Stop the last timer started on the calling thread.
+void AppTimerEnd();
+
+// Write frame and timer statistics to path, as JSON when the path ends with
+// .json and as CSV otherwise. Returns false if the file cannot be written.
+bool AppExportTelemetry(const char *path);
+
+// Export telemetry to path when the app closes, NULL disables it.
+void AppSetTelemetryExportPath(const char *path);
+
+// Return the memory held by textures, buffers and programs.
+MemoryStats AppGetMemoryStats();
+
+// Print the memory totals and largest allocations to stderr.
+void AppDumpMemoryStats();
+
+// Dump memory stats every frames frames, 0 disables it (the default).
+void AppSetMemoryDumpInterval(unsigned frames);
+
+// Set the directory for cached shader binaries and decoded texture payloads,
+// NULL disables caching. Defaults to $XDG_CACHE_HOME/SimpleKTX.
+void AppSetCacheDir(const char *dir);
+
+// Mount a bundle made with SimpleKTX_pack, shaders and textures are looked up
+// in it by path before the file system. Call before loading any asset.
+StatusCode AppMountBundle(const char *path);
+
 // Load, compile and link a shader program using a fragment and vertex shaders.
+// Linked programs are cached as binaries and reused while the driver accepts
+// them.
 Shader AppLoadShader(const char *vsPath, const char *fsPath);
 
 // Load and decode an image as texture
 Texture AppLoadTexture(const char *texPath);
 
+// Load many textures at once, files are read and Basis payloads transcoded in
+// parallel by the worker pool, then uploaded. Returns false if any failed.
+bool AppLoadTextures(const char **texPaths, int count, Texture *textures);
+
+// Start loading a texture in background, the returned id is valid at once but
+// the image is uploaded later by AppBeginFrame within the upload budget.
+Texture AppLoadTextureAsync(const char *texPath);
+
+// Return the load status of a texture, E_TEXTURE_PENDING while in progress.
+StatusCode AppGetTextureStatus(Texture texture);
+
+// Set how many bytes of texture data can be uploaded on each frame.
+void AppSetTextureUploadBudget(size_t bytesPerFrame);
+
+// Set the memory textures may use. CPU bytes is how much image data is kept
+// after upload for fast reloads (0 frees it at once, the default), GPU bytes
+// is the size of resident textures (0 means unlimited). Textures over budget
+// are evicted by least recent use and loaded again when rendered.
+void AppSetTextureBudget(size_t cpuBytes, size_t gpuBytes);
+
+// Generate mip chains on the CPU for uncompressed RGBA8 textures stored with
+// a single level, sRGB ones are filtered in linear light. RGBA8 files that ask
+// for mipmaps get them this way instead of with glGenerateMipmap.
+void AppSetMipmapGeneration(bool enabled);
+
+// Load a texture, generate its mip chain if missing and write every level to
+// dstPath as KTX1, so later loads skip generating it. Returns false if the
+// texture is not RGBA8 or a file cannot be read or written.
+bool AppWriteMipmappedKTX(const char *srcPath, const char *dstPath);
+
+// Return the GL name to bind for a texture and the target to bind it to, and
+// mark it as used this frame. Textures still loading give 0 until their first
+// upload sets the target, binding the name earlier would fix it to another.
+unsigned AppUseTexture(Texture texture, GLenum *target);
+
+// Load KTX files that share format, size and mip count as layers of a single
+// GL_TEXTURE_2D_ARRAY, files with array layers add all of them. The first
+// layer of each file is written to firstLayers if not NULL, models pick it
+// with Model.layer. Packed arrays are not managed by the residency budget.
+Texture AppPackTextureArray(const char **texPaths, int count,
+                            unsigned *firstLayers);
+
 // Release all resources linked to a texture
 void AppDestroyTexture(Texture texture);
 
 // Make a plane using the size as vertex positions and attach a texture (KTX2)
 Model AppMakePlane(float dim);
 
-// Render a model
+// Upload a mesh in a compact layout: half float positions, unorm8 colors,
+// unorm16 UVs (half float if they tile) and 16 bit indices when they fit.
+// Triangles and vertices are reordered for the vertex cache and fetches.
+Model AppMakeMesh(const MeshData *mesh);
+
+// Load a Wavefront OBJ mesh with positions, optional vertex colors and UVs,
+// polygons are triangulated. Normals are ignored.
+Model AppLoadMesh(const char *path);
+
+// Render a model, its shader may read the view projection as a mat4 uniform
+// named viewProj.
 void AppRenderModel(Model model);
 
+// Queue a model to be drawn with a transform on the next AppFlush. The model
+// shader must read the transform as an instanced mat4 at INSTANCE_LOCATION and
+// may read the model layer as a float at LAYER_LOCATION.
+void AppSubmit(Model model, Mat4 transform);
+
+// Draw every submitted model sorted by shader, texture and mesh, models
+// sharing all three are drawn with a single instanced call.
+void AppFlush();
+
+// Set the matrix shaders read as the viewProj uniform, identity by default.
+void AppSetViewProjection(Mat4 viewProj);
+
+// Add a model to the scene with a transform, models are culled against the
+// view frustum by AppSubmitScene. Returns a handle, 0 if out of memory.
+unsigned AppSceneAdd(Model model, Mat4 transform);
+
+// Change the transform of a model in the scene.
+void AppSceneMove(unsigned handle, Mat4 transform);
+
+// Remove a model from the scene, the model itself is not destroyed.
+void AppSceneRemove(unsigned handle);
+
+// Set the side of the grid cells the scene is indexed with, in world units.
+// Pick about the size of the largest models. Only while the scene is empty.
+void AppSetSceneCellSize(float size);
+
+// Submit the scene models inside the frustum of viewProj and make it the
+// view projection. Returns how many were submitted, draw them with AppFlush.
+unsigned AppSubmitScene(Mat4 viewProj);
+
+// Reserve size bytes of the streaming buffer for this frame, data is NULL if
+// the buffer cannot grow. The buffer is mapped once and split in three frames
+// guarded by fences, so writing only waits when the GPU is that far behind.
+StreamSpan AppStreamAlloc(StreamUsage usage, size_t size);
+
+// Make the data written to spans visible to the GPU, call before drawing with
+// them. Only copies when the driver lacks GL_ARB_buffer_storage.
+void AppStreamFlush();
+
+// Set how many bytes a frame can stream before the buffer has to grow, 4 MiB
+// by default. Takes effect when the buffer is first used.
+void AppSetStreamBufferSize(size_t bytesPerFrame);
+
+// Make an identity matrix.
+Mat4 AppMat4Identity();
+
+// Make a translation matrix.
+Mat4 AppMat4Translation(float x, float y, float z);
+
+// Make a scale matrix.
+Mat4 AppMat4Scale(float x, float y, float z);
+
+// Make an orthographic projection of a box, in the OpenGL clip space.
+Mat4 AppMat4Ortho(float left, float right, float bottom, float top,
+                  float near, float far);
+
+// Multiply two matrices, b is applied first.
+Mat4 AppMat4Multiply(Mat4 a, Mat4 b);
+
 // Release all resources linked to a model
 void AppDestroyModel(Model model);
 
 // Destroy a shader if needed.
 void AppDestroyShader(Shader shader);
+
+// Load a texture once, later calls with the same path or same file contents
+// return the same texture and add a reference to it.
+Texture AppAcquireTexture(const char *texPath);
+
+// Drop a reference to a texture, it is destroyed with the last one.
+void AppReleaseTexture(Texture texture);
+
+// Load a shader once, later calls with the same sources share the program.
+Shader AppAcquireShader(const char *vsPath, const char *fsPath);
+
+// Drop a reference to a shader, it is destroyed with the last one.
+void AppReleaseShader(Shader shader);
@@ -0,0 +1,349 @@
+#include "asset.h"
+
+// Standard libraries
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  bool configured;
+  bool enabled;
+  bool created;
+  char dir[PATH_MAX];
+  pthread_mutex_t lock;
+} CacheDir;
+
+static CacheDir cacheDir = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  const AssetBundleEntry *entries;
+  uint32_t entryCount;
+  const char *names;
+  uint64_t namesSize;
+} Bundle;
+
+static Bundle bundle = {0};
+
+// Numbers temporary files so threads writing the same file do not collide.
+static atomic_uint writeCount = 0;
+
+// Map a file and give the kernel a hint on how it is going to be read.
+static void *MapFile(const char *path, AssetAccess access, size_t *size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat info = {0};
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // The mapping keeps the file referenced, the descriptor is not needed
+  *size = (size_t)info.st_size;
+  void *mapping = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (access == ASSET_READ_SEQUENTIAL) {
+    madvise(mapping, *size, MADV_SEQUENTIAL);
+    madvise(mapping, *size, MADV_WILLNEED);
+  } else {
+    madvise(mapping, *size, MADV_RANDOM);
+  }
+
+  return mapping;
+}
+
+// Find a path in the mounted bundle index, NULL if it is not there.
+static const AssetBundleEntry *FindBundleEntry(const char *path) {
+  path = AssetBundlePath(path);
+  size_t length = strlen(path);
+  uint64_t hash = AssetHash(ASSET_HASH_SEED, path, length);
+
+  uint32_t low = 0;
+  uint32_t high = bundle.entryCount;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (bundle.entries[middle].hash < hash) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  // Names are compared too, a hash collision must not return other data
+  for (; low < bundle.entryCount && bundle.entries[low].hash == hash; low++) {
+    const AssetBundleEntry *entry = &bundle.entries[low];
+    if (entry->nameSize == length &&
+        memcmp(bundle.names + entry->nameOffset, path, length) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+// Start paging in a bundle payload, madvise needs a page aligned start.
+static void Prefetch(const unsigned char *data, size_t size) {
+  uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)data & ~(pageSize - 1);
+  madvise((void *)start, size + ((uintptr_t)data - start), MADV_WILLNEED);
+}
+
+// TODO(cedmundo): make multiplatform
+bool AssetOpen(const char *path, AssetAccess access, Asset *asset) {
+  assert(path != NULL && "invalid arg path: cannot be NULL");
+  assert(asset != NULL && "invalid arg asset: cannot be NULL");
+  *asset = (Asset){0};
+
+  // Bundled assets point into the bundle mapping, nothing to unmap later
+  const AssetBundleEntry *entry =
+      bundle.data != NULL ? FindBundleEntry(path) : NULL;
+  if (entry != NULL) {
+    asset->data = bundle.data + entry->offset;
+    asset->size = (size_t)entry->size;
+    if (access == ASSET_READ_SEQUENTIAL) {
+      Prefetch(asset->data, asset->size);
+    }
+    return true;
+  }
+
+  size_t size = 0;
+  void *mapping = MapFile(path, access, &size);
+  if (mapping == NULL) {
+    return false;
+  }
+
+  asset->data = mapping;
+  asset->size = size;
+  asset->mapping = mapping;
+  asset->mappingSize = size;
+  return true;
+}
+
+void AssetClose(Asset *asset) {
+  assert(asset != NULL && "invalid arg asset: cannot be NULL");
+  if (asset->mapping != NULL) {
+    munmap(asset->mapping, asset->mappingSize);
+  }
+
+  *asset = (Asset){0};
+}
+
+void AssetPageIn(const Asset *asset) {
+  assert(asset != NULL && "invalid arg asset: cannot be NULL");
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  volatile const unsigned char *bytes = asset->data;
+  unsigned char sum = 0;
+  for (size_t i = 0; i < asset->size; i += pageSize) {
+    sum += bytes[i];
+  }
+
+  if (asset->size > 0) {
+    sum += bytes[asset->size - 1];
+  }
+  (void)sum;
+}
+
+uint64_t AssetHash(uint64_t seed, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+void AssetSetCacheDir(const char *dir) {
+  pthread_mutex_lock(&cacheDir.lock);
+  cacheDir.configured = true;
+  cacheDir.created = false;
+  cacheDir.enabled = dir != NULL;
+  if (dir != NULL) {
+    snprintf(cacheDir.dir, sizeof(cacheDir.dir), "%s", dir);
+  }
+  pthread_mutex_unlock(&cacheDir.lock);
+}
+
+// Create every missing directory of path.
+static bool MakeDirs(char *path) {
+  for (char *c = path + 1; *c != '\0'; c++) {
+    if (*c != '/') {
+      continue;
+    }
+
+    *c = '\0';
+    bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+    *c = '/';
+    if (!made) {
+      return false;
+    }
+  }
+
+  return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// Resolve the default directory and create it, cacheDir.lock must be held.
+static bool PrepareCacheDir() {
+  if (!cacheDir.configured) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    cacheDir.configured = true;
+    cacheDir.enabled = true;
+    if (xdg != NULL && xdg[0] != '\0') {
+      snprintf(cacheDir.dir, sizeof(cacheDir.dir), "%s/SimpleKTX", xdg);
+    } else if (home != NULL && home[0] != '\0') {
+      snprintf(cacheDir.dir, sizeof(cacheDir.dir), "%s/.cache/SimpleKTX",
+               home);
+    } else {
+      cacheDir.enabled = false;
+    }
+  }
+
+  if (!cacheDir.enabled) {
+    return false;
+  }
+
+  if (!cacheDir.created) {
+    cacheDir.created = MakeDirs(cacheDir.dir);
+  }
+
+  return cacheDir.created;
+}
+
+bool AssetCacheEnabled() {
+  pthread_mutex_lock(&cacheDir.lock);
+  bool enabled = PrepareCacheDir();
+  pthread_mutex_unlock(&cacheDir.lock);
+  return enabled;
+}
+
+bool AssetCachePath(uint64_t key, const char *extension, char *path,
+                    size_t size) {
+  pthread_mutex_lock(&cacheDir.lock);
+  if (!PrepareCacheDir()) {
+    pthread_mutex_unlock(&cacheDir.lock);
+    return false;
+  }
+
+  int length = snprintf(path, size, "%s/%016" PRIx64 ".%s", cacheDir.dir, key,
+                        extension);
+  pthread_mutex_unlock(&cacheDir.lock);
+  return length > 0 && (size_t)length < size;
+}
+
+bool AssetWrite(const char *path, const void *data, size_t size) {
+  assert(path != NULL && "invalid arg path: cannot be NULL");
+  char tmpPath[PATH_MAX];
+  int length = snprintf(tmpPath, sizeof(tmpPath), "%s.%d.%u.tmp", path,
+                        getpid(), atomic_fetch_add(&writeCount, 1));
+  if (length < 0 || (size_t)length >= sizeof(tmpPath)) {
+    return false;
+  }
+
+  // Readers never see a partially written file
+  FILE *file = fopen(tmpPath, "we");
+  if (file == NULL) {
+    return false;
+  }
+
+  bool written = fwrite(data, 1, size, file) == size;
+  written = fclose(file) == 0 && written;
+  if (!written || rename(tmpPath, path) != 0) {
+    unlink(tmpPath);
+    return false;
+  }
+
+  return true;
+}
+
+const char *AssetBundlePath(const char *path) {
+  assert(path != NULL && "invalid arg path: cannot be NULL");
+  while (path[0] == '.' && path[1] == '/') {
+    path += 2;
+  }
+
+  return path;
+}
+
+bool AssetMountBundle(const char *path) {
+  assert(path != NULL && "invalid arg path: cannot be NULL");
+  AssetUnmountBundle();
+
+  // Index lookups jump around, payload reads hint their own range
+  size_t size = 0;
+  unsigned char *data = MapFile(path, ASSET_READ_RANDOM, &size);
+  if (data == NULL) {
+    return false;
+  }
+
+  const AssetBundleHeader *header = (const AssetBundleHeader *)data;
+  uint64_t indexEnd = sizeof(AssetBundleHeader);
+  if (size < sizeof(AssetBundleHeader) ||
+      memcmp(header->magic, ASSET_BUNDLE_MAGIC, 4) != 0 ||
+      header->version != ASSET_BUNDLE_VERSION) {
+    goto invalid;
+  }
+
+  indexEnd += (uint64_t)header->entryCount * sizeof(AssetBundleEntry);
+  if (indexEnd > size || header->namesOffset < indexEnd ||
+      header->namesOffset > size ||
+      header->namesSize > size - header->namesOffset) {
+    goto invalid;
+  }
+
+  // Validate once so lookups can trust every offset
+  const AssetBundleEntry *entries =
+      (const AssetBundleEntry *)(data + sizeof(AssetBundleHeader));
+  for (uint32_t i = 0; i < header->entryCount; i++) {
+    const AssetBundleEntry *entry = &entries[i];
+    if (entry->offset > size || entry->size > size - entry->offset ||
+        (uint64_t)entry->nameOffset + entry->nameSize > header->namesSize ||
+        (i > 0 && entries[i - 1].hash > entry->hash)) {
+      goto invalid;
+    }
+  }
+
+  bundle = (Bundle){
+      .data = data,
+      .size = size,
+      .entries = entries,
+      .entryCount = header->entryCount,
+      .names = (const char *)data + header->namesOffset,
+      .namesSize = header->namesSize,
+  };
+  return true;
+
+invalid:
+  fprintf(stderr, "invalid bundle %s\n", path);
+  munmap(data, size);
+  return false;
+}
+
+void AssetUnmountBundle() {
+  if (bundle.data != NULL) {
+    munmap((void *)bundle.data, bundle.size);
+  }
+
+  bundle = (Bundle){0};
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How the contents of an asset are going to be read, used as paging hint.
+typedef enum {
+  ASSET_READ_SEQUENTIAL,
+  ASSET_READ_RANDOM,
+} AssetAccess;
+
+// Read-only view of a file mapped in memory.
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  void *mapping;
+  size_t mappingSize;
+} Asset;
+
+// Map a whole file in memory, returns false if it cannot be opened or is empty.
+bool AssetOpen(const char *path, AssetAccess access, Asset *asset);
+
+// Unmap the file, data cannot be used after this.
+void AssetClose(Asset *asset);
+
+// Fault in every page of an asset on the calling thread, so later reads from
+// another thread do not wait on the disk.
+void AssetPageIn(const Asset *asset);
+
+// Hash bytes with 64 bit FNV-1a, seed with ASSET_HASH_SEED or a previous hash.
+uint64_t AssetHash(uint64_t seed, const void *data, size_t size);
+
+#define ASSET_HASH_SEED 0xcbf29ce484222325ULL
+
+// Set the directory for cached files, NULL disables caching. By default it is
+// $XDG_CACHE_HOME/SimpleKTX or ~/.cache/SimpleKTX.
+void AssetSetCacheDir(const char *dir);
+
+// Check if caching is enabled, creating the cache directory if needed. Lets
+// callers skip computing keys nothing would be stored under.
+bool AssetCacheEnabled();
+
+// Build the path of the cache file for key with an extension, creating the
+// cache directory if needed. Returns false if caching is disabled.
+bool AssetCachePath(uint64_t key, const char *extension, char *path,
+                    size_t size);
+
+// Write a whole file, replacing it atomically. Returns false on failure.
+bool AssetWrite(const char *path, const void *data, size_t size);
+
+// Bundles pack many assets in one file: a header, an index of entries sorted
+// by path hash, the path strings and the payloads, each one page aligned so
+// it can be handed out straight from the mapping. Fields are little endian.
+#define ASSET_BUNDLE_MAGIC "SKAB"
+#define ASSET_BUNDLE_VERSION 1
+#define ASSET_BUNDLE_ALIGN 4096
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t reserved;
+  uint64_t namesOffset;
+  uint64_t namesSize;
+} AssetBundleHeader;
+
+typedef struct {
+  uint64_t hash;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t nameOffset;
+  uint32_t nameSize;
+} AssetBundleEntry;
+
+// Path as stored in a bundle, without leading "./".
+const char *AssetBundlePath(const char *path);
+
+// Map a bundle, AssetOpen looks paths up in it before the file system.
+// Replaces the mounted bundle, must not be called while assets are open.
+bool AssetMountBundle(const char *path);
+
+// Unmap the mounted bundle, assets opened from it cannot be used after this.
+void AssetUnmountBundle();
@@ -0,0 +1,12 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec3 col;
+in vec2 uvs;
+flat in float layer;
+uniform sampler2DArray tex0;
+
+void main() {
+  FragColor = texture(tex0, vec3(uvs, layer)) * vec4(col, 1.0);
+}
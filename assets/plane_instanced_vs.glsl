@@ -0,0 +1,20 @@
+#version 330 core
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inCol;
+layout (location = 2) in vec2 inUvs;
+layout (location = 3) in mat4 inModel;
+layout (location = 7) in float inLayer;
+
+out vec3 col;
+out vec2 uvs;
+flat out float layer;
+
+uniform mat4 viewProj;
+
+void main() {
+  gl_Position = viewProj * inModel * vec4(inPos, 1.0);
+  col = inCol;
+  uvs = inUvs;
+  layer = inLayer;
+}
@@ -0,0 +1,268 @@
+#include "batch.h"
+#include "app.h"
+
+// Standard libraries
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLAD
+#include <glad/glad.h>
+
+typedef struct {
+  Mat4 transform;
+  float layer;
+} Instance;
+
+typedef struct {
+  unsigned program;
+  int viewProjLocation;
+  GLenum target;
+  unsigned texture;
+  unsigned vao;
+  unsigned indexCount;
+  GLenum indexType;
+  Instance instance;
+} BatchItem;
+
+typedef struct {
+  BatchItem *items;
+  unsigned count;
+  unsigned capacity;
+  bool hasViewProj;
+  Mat4 viewProj;
+} Batch;
+
+static Batch batch = {0};
+
+// Targets textures are bound to, a run clears the ones it does not use so a
+// leftover binding cannot be sampled in place of its texture.
+static const GLenum textureTargets[] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_2D_ARRAY,
+    GL_TEXTURE_CUBE_MAP,
+};
+
+void AppSubmit(Model model, Mat4 transform) {
+  assert(model.vao != 0 && "invalid arg model.vao: uninitialized vertex array");
+  if (batch.count == batch.capacity) {
+    unsigned capacity = batch.capacity == 0 ? 256 : batch.capacity * 2;
+    BatchItem *items = realloc(batch.items, capacity * sizeof(BatchItem));
+    assert(items != NULL && "out of memory: cannot grow batch");
+    batch.items = items;
+    batch.capacity = capacity;
+  }
+
+  // Textures are resolved now, eviction may change their GL name
+  GLenum target = 0;
+  unsigned texture = AppUseTexture(model.texture, &target);
+  batch.items[batch.count++] = (BatchItem){
+      .program = model.shader.spId,
+      .viewProjLocation = model.shader.viewProjLocation,
+      .target = target,
+      .texture = texture,
+      .vao = model.vao,
+      .indexCount = model.indexCount,
+      .indexType = model.indexType,
+      .instance = {.transform = transform, .layer = (float)model.layer},
+  };
+}
+
+// Program changes cost the most, then textures, then vertex arrays.
+static int CompareItems(const void *a, const void *b) {
+  const BatchItem *lhs = a;
+  const BatchItem *rhs = b;
+  if (lhs->program != rhs->program) {
+    return lhs->program < rhs->program ? -1 : 1;
+  }
+
+  if (lhs->texture != rhs->texture) {
+    return lhs->texture < rhs->texture ? -1 : 1;
+  }
+
+  if (lhs->vao != rhs->vao) {
+    return lhs->vao < rhs->vao ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static bool SameDraw(const BatchItem *lhs, const BatchItem *rhs) {
+  return lhs->program == rhs->program && lhs->texture == rhs->texture &&
+         lhs->vao == rhs->vao && lhs->indexCount == rhs->indexCount;
+}
+
+// Stream all instances in sorted order so each run is a contiguous range.
+static StreamSpan UploadInstances() {
+  StreamSpan span =
+      AppStreamAlloc(STREAM_VERTEX, batch.count * sizeof(Instance));
+  if (span.data == NULL) {
+    return span;
+  }
+
+  Instance *instances = span.data;
+  for (unsigned i = 0; i < batch.count; i++) {
+    instances[i] = batch.items[i].instance;
+  }
+
+  AppStreamFlush();
+  glBindBuffer(GL_ARRAY_BUFFER, span.buffer);
+  return span;
+}
+
+// Point the instance attributes of the bound vertex array at first.
+static void BindInstances(StreamSpan span, unsigned first) {
+  size_t base = span.offset + first * sizeof(Instance);
+  for (int column = 0; column < 4; column++) {
+    size_t offset = base + column * 4 * sizeof(float);
+    glVertexAttribPointer(INSTANCE_LOCATION + column, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(Instance), (void *)offset);
+    glVertexAttribDivisor(INSTANCE_LOCATION + column, 1);
+    glEnableVertexAttribArray(INSTANCE_LOCATION + column);
+  }
+
+  size_t offset = base + offsetof(Instance, layer);
+  glVertexAttribPointer(LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE,
+                        sizeof(Instance), (void *)offset);
+  glVertexAttribDivisor(LAYER_LOCATION, 1);
+  glEnableVertexAttribArray(LAYER_LOCATION);
+}
+
+void AppFlush() {
+  if (batch.count == 0) {
+    return;
+  }
+
+  AppTimerBegin("draw");
+  qsort(batch.items, batch.count, sizeof(BatchItem), CompareItems);
+  StreamSpan span = UploadInstances();
+  if (span.data == NULL) {
+    batch.count = 0;
+    AppTimerEnd();
+    return;
+  }
+
+  // Bindings are unknown when the flush starts, no run matches ~0u
+  unsigned program = ~0u;
+  GLenum target = ~0u;
+  unsigned texture = ~0u;
+  unsigned vao = ~0u;
+  unsigned first = 0;
+  while (first < batch.count) {
+    const BatchItem *item = &batch.items[first];
+    unsigned last = first + 1;
+    while (last < batch.count && SameDraw(item, &batch.items[last])) {
+      last++;
+    }
+
+    if (item->program != program) {
+      glUseProgram(item->program);
+      BatchLoadViewProjection(item->viewProjLocation);
+      program = item->program;
+    }
+
+    if (item->texture != texture || item->target != target) {
+      for (size_t i = 0; i < sizeof(textureTargets) / sizeof(GLenum); i++) {
+        GLenum other = textureTargets[i];
+        if (other != item->target && (target == ~0u || other == target)) {
+          glBindTexture(other, 0);
+        }
+      }
+
+      glBindTexture(item->target, item->texture);
+      target = item->target;
+      texture = item->texture;
+    }
+
+    if (item->vao != vao) {
+      glBindVertexArray(item->vao);
+      vao = item->vao;
+    }
+
+    // The element buffer is part of the vertex array state
+    BindInstances(span, first);
+    glDrawElementsInstanced(GL_TRIANGLES, item->indexCount, item->indexType,
+                            0, last - first);
+    first = last;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  batch.count = 0;
+  AppTimerEnd();
+}
+
+void AppSetViewProjection(Mat4 viewProj) {
+  batch.viewProj = viewProj;
+  batch.hasViewProj = true;
+}
+
+void BatchLoadViewProjection(int location) {
+  if (location >= 0) {
+    Mat4 viewProj = batch.hasViewProj ? batch.viewProj : AppMat4Identity();
+    glUniformMatrix4fv(location, 1, GL_FALSE, viewProj.m);
+  }
+}
+
+Mat4 AppMat4Identity() {
+  return AppMat4Translation(0.0f, 0.0f, 0.0f);
+}
+
+Mat4 AppMat4Translation(float x, float y, float z) {
+  Mat4 mat = {{
+      1.0f, 0.0f, 0.0f, 0.0f, // first column
+      0.0f, 1.0f, 0.0f, 0.0f, // second column
+      0.0f, 0.0f, 1.0f, 0.0f, // third column
+      x,    y,    z,    1.0f, // fourth column
+  }};
+  return mat;
+}
+
+Mat4 AppMat4Scale(float x, float y, float z) {
+  Mat4 mat = {{
+      x,    0.0f, 0.0f, 0.0f, // first column
+      0.0f, y,    0.0f, 0.0f, // second column
+      0.0f, 0.0f, z,    0.0f, // third column
+      0.0f, 0.0f, 0.0f, 1.0f, // fourth column
+  }};
+  return mat;
+}
+
+Mat4 AppMat4Ortho(float left, float right, float bottom, float top,
+                  float near, float far) {
+  assert(left != right && "invalid arg right: same as left");
+  assert(bottom != top && "invalid arg top: same as bottom");
+  assert(near != far && "invalid arg far: same as near");
+  float width = right - left;
+  float height = top - bottom;
+  float depth = far - near;
+  Mat4 mat = {{
+      2.0f / width, 0.0f, 0.0f, 0.0f,  // first column
+      0.0f, 2.0f / height, 0.0f, 0.0f, // second column
+      0.0f, 0.0f, -2.0f / depth, 0.0f, // third column
+      -(right + left) / width, -(top + bottom) / height,
+      -(far + near) / depth, 1.0f, // fourth column
+  }};
+  return mat;
+}
+
+Mat4 AppMat4Multiply(Mat4 a, Mat4 b) {
+  Mat4 mat = {0};
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      float sum = 0.0f;
+      for (int k = 0; k < 4; k++) {
+        sum += a.m[k * 4 + row] * b.m[column * 4 + k];
+      }
+      mat.m[column * 4 + row] = sum;
+    }
+  }
+
+  return mat;
+}
+
+void BatchShutdown() {
+  free(batch.items);
+  batch = (Batch){0};
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Set the viewProj uniform of the program in use at location, -1 for none.
+// Used by AppRenderModel.
+void BatchLoadViewProjection(int location);
+
+// Free the submission queue, used by AppClose.
+void BatchShutdown();
@@ -0,0 +1,448 @@
+#include "app.h"
+#include "asset.h"
+#include "mesh.h"
+#include "mipmap.h"
+
+// Standard libraries
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// GLAD
+#include <glad/glad.h>
+
+#define BENCH_WIDTH 256
+#define BENCH_HEIGHT 256
+
+// Quads per side of the grid mesh and the FIFO cache size simulated.
+#define BENCH_GRID 256
+#define BENCH_CACHE_SIZE 16
+
+// Models per side of the scene field and the part of it in view.
+#define BENCH_SCENE_SIDE 200
+#define BENCH_SCENE_VIEW 0.1f
+
+// Side of the sRGB image mip chains are built for.
+#define BENCH_MIPMAP_SIZE 1024
+#define MAX_BENCH_LEVELS 32
+
+#define PLANE_VS_PATH "assets/plane_vs.glsl"
+#define PLANE_INSTANCED_VS_PATH "assets/plane_instanced_vs.glsl"
+#define PLANE_FS_PATH "assets/plane_fs.glsl"
+#define PLANE_TEXTURE "assets/plane_tex.ktx"
+
+typedef struct {
+  const char *texPath;
+  int iterations;
+  int models;
+  int frames;
+} BenchConfig;
+
+// Monotonic time in seconds.
+static double Now() {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Results are printed as one JSON object per line.
+static void Report(const char *scenario, const char *unit, double value,
+                   int iterations, double seconds) {
+  printf("{\"scenario\": \"%s\", \"iterations\": %d, \"seconds\": %.6f, "
+         "\"%s\": %.3f}\n",
+         scenario, iterations, seconds, unit, value);
+  fflush(stdout);
+}
+
+static bool BenchParse(const BenchConfig *config) {
+  Asset asset = {0};
+  if (!AssetOpen(config->texPath, ASSET_READ_SEQUENTIAL, &asset)) {
+    fprintf(stderr, "cannot open %s\n", config->texPath);
+    return false;
+  }
+
+  double start = Now();
+  for (int i = 0; i < config->iterations; i++) {
+    ktxTexture *src = NULL;
+    KTX_error_code result =
+        ktxTexture_CreateFromMemory(asset.data, asset.size,
+                                    KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT,
+                                    &src);
+    if (result != KTX_SUCCESS) {
+      fprintf(stderr, "cannot parse %s\n", config->texPath);
+      AssetClose(&asset);
+      return false;
+    }
+    ktxTexture_Destroy(src);
+  }
+  double seconds = Now() - start;
+
+  double megabytes = (double)asset.size * config->iterations / (1024 * 1024);
+  Report("ktx_parse", "mb_per_s", megabytes / seconds, config->iterations,
+         seconds);
+  AssetClose(&asset);
+  return true;
+}
+
+static bool BenchUpload(const BenchConfig *config) {
+  ktxTexture *src = NULL;
+  KTX_error_code result = ktxTexture_CreateFromNamedFile(
+      config->texPath, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &src);
+  if (result != KTX_SUCCESS) {
+    fprintf(stderr, "cannot parse %s\n", config->texPath);
+    return false;
+  }
+
+  // glFinish makes the driver copy part of the measure
+  double start = Now();
+  for (int i = 0; i < config->iterations; i++) {
+    unsigned id = 0;
+    GLenum target = 0;
+    GLenum glError = 0;
+    glGenTextures(1, &id);
+    result = ktxTexture_GLUpload(src, &id, &target, &glError);
+    glFinish();
+    glDeleteTextures(1, &id);
+    if (result != KTX_SUCCESS) {
+      fprintf(stderr, "cannot upload %s\n", config->texPath);
+      ktxTexture_Destroy(src);
+      return false;
+    }
+  }
+  double seconds = Now() - start;
+
+  double megabytes = (double)ktxTexture_GetDataSize(src) *
+                     config->iterations / (1024 * 1024);
+  Report("ktx_upload", "mb_per_s", megabytes / seconds, config->iterations,
+         seconds);
+  ktxTexture_Destroy(src);
+  return true;
+}
+
+// Remove a flat directory and its files.
+static void RemoveDir(const char *path) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return;
+  }
+
+  struct dirent *entry = NULL;
+  while ((entry = readdir(dir)) != NULL) {
+    char file[512];
+    if (entry->d_name[0] != '.') {
+      snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+      unlink(file);
+    }
+  }
+
+  closedir(dir);
+  rmdir(path);
+}
+
+// Compile shaders without cache, or with a fresh one when cached is set so
+// only the first iteration compiles.
+static bool BenchShader(const BenchConfig *config, bool cached) {
+  char cacheDir[] = "/tmp/SimpleKTX_bench_XXXXXX";
+  if (cached && mkdtemp(cacheDir) == NULL) {
+    fprintf(stderr, "cannot create cache dir\n");
+    return false;
+  }
+  AppSetCacheDir(cached ? cacheDir : NULL);
+  bool ok = false;
+
+  // The cached run times loads of a binary already stored
+  if (cached) {
+    Shader shader = AppLoadShader(PLANE_VS_PATH, PLANE_FS_PATH);
+    if (shader.status != SUCCESS) {
+      goto terminate;
+    }
+    AppDestroyShader(shader);
+  }
+
+  double start = Now();
+  for (int i = 0; i < config->iterations; i++) {
+    Shader shader = AppLoadShader(PLANE_VS_PATH, PLANE_FS_PATH);
+    if (shader.status != SUCCESS) {
+      goto terminate;
+    }
+    AppDestroyShader(shader);
+  }
+  glFinish();
+  double seconds = Now() - start;
+
+  Report(cached ? "shader_cached" : "shader_compile", "ms_per_program",
+         seconds * 1000.0 / config->iterations, config->iterations, seconds);
+  ok = true;
+
+terminate:
+  AppSetCacheDir(NULL);
+  if (cached) {
+    RemoveDir(cacheDir);
+  }
+  return ok;
+}
+
+// Draw the same plane models times per frame, individually or batched.
+static bool BenchDraw(const BenchConfig *config, bool batched) {
+  const char *vsPath = batched ? PLANE_INSTANCED_VS_PATH : PLANE_VS_PATH;
+  Shader shader = AppLoadShader(vsPath, PLANE_FS_PATH);
+  if (shader.status != SUCCESS) {
+    return false;
+  }
+
+  Texture texture = AppLoadTexture(config->texPath);
+  if (texture.status != SUCCESS) {
+    AppDestroyTexture(texture);
+    AppDestroyShader(shader);
+    return false;
+  }
+
+  Model model = AppMakePlane(0.5f);
+  model.shader = shader;
+  model.texture = texture;
+
+  double start = Now();
+  for (int frame = 0; frame < config->frames; frame++) {
+    AppBeginFrame();
+    for (int i = 0; i < config->models; i++) {
+      if (batched) {
+        AppSubmit(model, AppMat4Identity());
+      } else {
+        AppRenderModel(model);
+      }
+    }
+    if (batched) {
+      AppFlush();
+    }
+    AppEndFrame();
+  }
+  glFinish();
+  double seconds = Now() - start;
+
+  char scenario[64];
+  snprintf(scenario, sizeof(scenario), "%s_%d",
+           batched ? "draw_batched" : "draw_models", config->models);
+  double draws = (double)config->models * config->frames;
+  Report(scenario, "models_per_s", draws / seconds, config->frames, seconds);
+
+  AppDestroyModel(model);
+  AppDestroyTexture(texture);
+  AppDestroyShader(shader);
+  return true;
+}
+
+// Shuffle the triangles of a grid and measure how well the optimizer restores
+// vertex cache locality, reported as cache misses per triangle.
+static bool BenchMesh() {
+  unsigned vertexCount = (BENCH_GRID + 1) * (BENCH_GRID + 1);
+  unsigned triangleCount = BENCH_GRID * BENCH_GRID * 2;
+  unsigned *indices = malloc(triangleCount * 3 * sizeof(unsigned));
+  if (indices == NULL) {
+    return false;
+  }
+
+  unsigned count = 0;
+  for (unsigned y = 0; y < BENCH_GRID; y++) {
+    for (unsigned x = 0; x < BENCH_GRID; x++) {
+      unsigned corner = y * (BENCH_GRID + 1) + x;
+      unsigned quad[6] = {corner,     corner + BENCH_GRID + 1, corner + 1,
+                          corner + 1, corner + BENCH_GRID + 1,
+                          corner + BENCH_GRID + 2};
+      memcpy(&indices[count], quad, sizeof(quad));
+      count += 6;
+    }
+  }
+
+  srand(1);
+  for (unsigned i = triangleCount - 1; i > 0; i--) {
+    unsigned j = (unsigned)rand() % (i + 1);
+    for (int c = 0; c < 3; c++) {
+      unsigned swap = indices[i * 3 + c];
+      indices[i * 3 + c] = indices[j * 3 + c];
+      indices[j * 3 + c] = swap;
+    }
+  }
+
+  Report("mesh_shuffled", "acmr",
+         MeshCacheMissRatio(indices, count, vertexCount, BENCH_CACHE_SIZE), 1,
+         0.0);
+
+  double start = Now();
+  MeshOptimizeVertexCache(indices, count, vertexCount);
+  double seconds = Now() - start;
+  Report("mesh_optimized", "acmr",
+         MeshCacheMissRatio(indices, count, vertexCount, BENCH_CACHE_SIZE), 1,
+         seconds);
+
+  free(indices);
+  return true;
+}
+
+// Cull a field of models and draw the few in view, frames per second shows
+// what a scene costs when most of it is out of view.
+static bool BenchScene(const BenchConfig *config) {
+  Shader shader = AppLoadShader(PLANE_INSTANCED_VS_PATH, PLANE_FS_PATH);
+  if (shader.status != SUCCESS) {
+    return false;
+  }
+
+  Model model = AppMakePlane(0.4f);
+  model.shader = shader;
+  unsigned count = BENCH_SCENE_SIDE * BENCH_SCENE_SIDE;
+  unsigned *handles = malloc(count * sizeof(unsigned));
+  if (handles == NULL) {
+    AppDestroyModel(model);
+    AppDestroyShader(shader);
+    return false;
+  }
+
+  AppSetSceneCellSize(4.0f);
+  float origin = -0.5f * BENCH_SCENE_SIDE;
+  for (unsigned i = 0; i < count; i++) {
+    float x = origin + (float)(i % BENCH_SCENE_SIDE);
+    float y = origin + (float)(i / BENCH_SCENE_SIDE);
+    handles[i] = AppSceneAdd(model, AppMat4Translation(x, y, 0.0f));
+  }
+
+  float half = 0.5f * BENCH_SCENE_VIEW * BENCH_SCENE_SIDE;
+  Mat4 viewProj = AppMat4Ortho(-half, half, -half, half, -1.0f, 1.0f);
+  unsigned visible = 0;
+  double start = Now();
+  for (int frame = 0; frame < config->frames; frame++) {
+    AppBeginFrame();
+    visible = AppSubmitScene(viewProj);
+    AppFlush();
+    AppEndFrame();
+  }
+  glFinish();
+  double seconds = Now() - start;
+
+  char scenario[64];
+  snprintf(scenario, sizeof(scenario), "scene_%u_visible_%u", count, visible);
+  Report(scenario, "frames_per_s", config->frames / seconds, config->frames,
+         seconds);
+
+  for (unsigned i = 0; i < count; i++) {
+    if (handles[i] != 0) {
+      AppSceneRemove(handles[i]);
+    }
+  }
+  AppSetViewProjection(AppMat4Identity());
+  free(handles);
+  AppDestroyModel(model);
+  AppDestroyShader(shader);
+  return true;
+}
+
+// Build and upload the mip chain of an sRGB image, with the CPU generator or
+// uploading the base level and calling glGenerateMipmap.
+static bool BenchMipmap(const BenchConfig *config, bool cpu) {
+  unsigned levels = MipmapLevelCount(BENCH_MIPMAP_SIZE, BENCH_MIPMAP_SIZE);
+  size_t offsets[MAX_BENCH_LEVELS] = {0};
+  size_t size = 0;
+  for (unsigned level = 0; level < levels; level++) {
+    unsigned side = BENCH_MIPMAP_SIZE >> level;
+    offsets[level] = size;
+    size += (size_t)side * side * 4;
+  }
+
+  unsigned char *data = malloc(size);
+  if (data == NULL) {
+    return false;
+  }
+
+  srand(1);
+  for (size_t i = 0; i < offsets[1]; i++) {
+    data[i] = (unsigned char)rand();
+  }
+
+  double start = Now();
+  for (int i = 0; i < config->iterations; i++) {
+    unsigned id = 0;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    if (cpu) {
+      MipmapGenerate(data, offsets, levels, 1, BENCH_MIPMAP_SIZE,
+                     BENCH_MIPMAP_SIZE, true);
+    }
+
+    for (unsigned level = 0; level < (cpu ? levels : 1); level++) {
+      unsigned side = BENCH_MIPMAP_SIZE >> level;
+      glTexImage2D(GL_TEXTURE_2D, level, GL_SRGB8_ALPHA8, side, side, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, data + offsets[level]);
+    }
+
+    if (!cpu) {
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glFinish();
+    glDeleteTextures(1, &id);
+  }
+  double seconds = Now() - start;
+
+  char scenario[64];
+  snprintf(scenario, sizeof(scenario), "mipmap_%s",
+           cpu ? MipmapKernelName() : "gl");
+  double megapixels = (double)BENCH_MIPMAP_SIZE * BENCH_MIPMAP_SIZE *
+                      config->iterations / 1e6;
+  Report(scenario, "mpixels_per_s", megapixels / seconds, config->iterations,
+         seconds);
+  free(data);
+  return true;
+}
+
+static void Usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--iterations N] [--models N] [--frames N] [file.ktx]\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  BenchConfig config = {
+      .texPath = PLANE_TEXTURE,
+      .iterations = 50,
+      .models = 1000,
+      .frames = 100,
+  };
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      config.iterations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--models") == 0 && i + 1 < argc) {
+      config.models = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      config.frames = atoi(argv[++i]);
+    } else if (argv[i][0] != '-') {
+      config.texPath = argv[i];
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (config.iterations <= 0 || config.models <= 0 || config.frames <= 0) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  // Caches would make runs depend on the previous ones
+  AppSetCacheDir(NULL);
+  StatusCode status = AppInitOffscreen(BENCH_WIDTH, BENCH_HEIGHT);
+  if (status != SUCCESS) {
+    AppClose();
+    return Exit(status);
+  }
+
+  bool ok = BenchParse(&config) && BenchUpload(&config) &&
+            BenchShader(&config, false) && BenchShader(&config, true) &&
+            BenchDraw(&config, false) && BenchDraw(&config, true) &&
+            BenchScene(&config) && BenchMesh() &&
+            BenchMipmap(&config, false) && BenchMipmap(&config, true);
+
+  AppClose();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+#include "cache.h"
+#include "app.h"
+#include "asset.h"
+
+// Standard libraries
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  RESOURCE_TEXTURE,
+  RESOURCE_SHADER,
+} ResourceKind;
+
+// A path already seen and the hash of its contents.
+typedef struct {
+  ResourceKind kind;
+  uint64_t keyHash;
+  char *key;
+  uint64_t contentHash;
+} CachePath;
+
+// A loaded resource shared by every path with the same contents.
+typedef struct {
+  ResourceKind kind;
+  uint64_t contentHash;
+  int refs;
+  Texture texture;
+  Shader shader;
+} CacheEntry;
+
+typedef struct {
+  CachePath *paths;
+  unsigned pathCount;
+  unsigned pathCapacity;
+  CacheEntry *entries;
+  unsigned entryCount;
+  unsigned entryCapacity;
+} Cache;
+
+static Cache cache = {0};
+
+// Grow an array to hold one more item, returns false when out of memory.
+static bool Reserve(void **items, unsigned count, unsigned *capacity,
+                    size_t itemSize) {
+  if (count < *capacity) {
+    return true;
+  }
+
+  unsigned newCapacity = *capacity == 0 ? 16 : *capacity * 2;
+  void *newItems = realloc(*items, newCapacity * itemSize);
+  if (newItems == NULL) {
+    return false;
+  }
+
+  *items = newItems;
+  *capacity = newCapacity;
+  return true;
+}
+
+// Resolve the content hash of a key, files are hashed unless the key was
+// remembered. Sizes separate the files so moving bytes from one to the next
+// changes the hash.
+static bool ResolveHash(ResourceKind kind, const char *key, const char **files,
+                        int fileCount, uint64_t *hash, bool *remembered) {
+  uint64_t keyHash = AssetHash(ASSET_HASH_SEED, key, strlen(key));
+  for (unsigned i = 0; i < cache.pathCount; i++) {
+    CachePath *path = &cache.paths[i];
+    if (path->kind == kind && path->keyHash == keyHash &&
+        strcmp(path->key, key) == 0) {
+      *hash = path->contentHash;
+      *remembered = true;
+      return true;
+    }
+  }
+
+  uint64_t contentHash = ASSET_HASH_SEED;
+  for (int i = 0; i < fileCount; i++) {
+    Asset asset = {0};
+    if (!AssetOpen(files[i], ASSET_READ_SEQUENTIAL, &asset)) {
+      return false;
+    }
+
+    contentHash = AssetHash(contentHash, asset.data, asset.size);
+    if (i + 1 < fileCount) {
+      contentHash = AssetHash(contentHash, &asset.size, sizeof(asset.size));
+    }
+    AssetClose(&asset);
+  }
+
+  *hash = contentHash;
+  *remembered = false;
+  return true;
+}
+
+// Remember the content hash of a key once its resource is loaded, so failed
+// loads leave nothing behind. Out of memory only means hashing again.
+static void RememberHash(ResourceKind kind, const char *key,
+                         uint64_t contentHash) {
+  char *copy = strdup(key);
+  if (copy == NULL ||
+      !Reserve((void **)&cache.paths, cache.pathCount, &cache.pathCapacity,
+               sizeof(CachePath))) {
+    free(copy);
+    return;
+  }
+
+  cache.paths[cache.pathCount++] = (CachePath){
+      .kind = kind,
+      .keyHash = AssetHash(ASSET_HASH_SEED, key, strlen(key)),
+      .key = copy,
+      .contentHash = contentHash,
+  };
+}
+
+static CacheEntry *FindEntry(ResourceKind kind, uint64_t contentHash) {
+  for (unsigned i = 0; i < cache.entryCount; i++) {
+    if (cache.entries[i].kind == kind &&
+        cache.entries[i].contentHash == contentHash) {
+      return &cache.entries[i];
+    }
+  }
+
+  return NULL;
+}
+
+static CacheEntry *AddEntry(ResourceKind kind, uint64_t contentHash) {
+  if (!Reserve((void **)&cache.entries, cache.entryCount, &cache.entryCapacity,
+               sizeof(CacheEntry))) {
+    return NULL;
+  }
+
+  CacheEntry *entry = &cache.entries[cache.entryCount++];
+  *entry = (CacheEntry){.kind = kind, .contentHash = contentHash, .refs = 1};
+  return entry;
+}
+
+// Remove an entry and the paths pointing to it, so they are hashed again if
+// loaded later on.
+static void RemoveEntry(CacheEntry *entry) {
+  unsigned i = 0;
+  while (i < cache.pathCount) {
+    CachePath *path = &cache.paths[i];
+    if (path->kind == entry->kind && path->contentHash == entry->contentHash) {
+      free(path->key);
+      cache.paths[i] = cache.paths[--cache.pathCount];
+      continue;
+    }
+    i++;
+  }
+
+  *entry = cache.entries[--cache.entryCount];
+}
+
+Texture AppAcquireTexture(const char *texPath) {
+  assert(texPath != NULL && "invalid arg texPath: cannot be NULL");
+  Texture texture = {0};
+  uint64_t hash = 0;
+  bool remembered = false;
+
+  if (!ResolveHash(RESOURCE_TEXTURE, texPath, &texPath, 1, &hash,
+                   &remembered)) {
+    texture.status = E_CANNOT_LOAD_FILE;
+    return texture;
+  }
+
+  CacheEntry *entry = FindEntry(RESOURCE_TEXTURE, hash);
+  if (entry != NULL) {
+    entry->refs += 1;
+    texture = entry->texture;
+    goto terminate;
+  }
+
+  texture = CacheLoadTexture(texPath, hash);
+  if (texture.status != SUCCESS) {
+    AppDestroyTexture(texture);
+    texture.id = 0;
+    return texture;
+  }
+
+  entry = AddEntry(RESOURCE_TEXTURE, hash);
+  if (entry == NULL) {
+    AppDestroyTexture(texture);
+    return (Texture){.status = E_CANNOT_CREATE_TEXTURE};
+  }
+  entry->texture = texture;
+
+terminate:
+  if (!remembered) {
+    RememberHash(RESOURCE_TEXTURE, texPath, hash);
+  }
+
+  return texture;
+}
+
+void AppReleaseTexture(Texture texture) {
+  for (unsigned i = 0; i < cache.entryCount; i++) {
+    // Slot textures change names when evicted, names are reused once deleted
+    CacheEntry *entry = &cache.entries[i];
+    bool same = texture.slot != 0 ? entry->texture.slot == texture.slot
+                                  : entry->texture.slot == 0 &&
+                                        entry->texture.id == texture.id;
+    if (entry->kind != RESOURCE_TEXTURE || !same) {
+      continue;
+    }
+
+    entry->refs -= 1;
+    if (entry->refs == 0) {
+      AppDestroyTexture(entry->texture);
+      RemoveEntry(entry);
+    }
+    return;
+  }
+
+  assert(false && "invalid arg texture: not acquired from the cache");
+}
+
+Shader AppAcquireShader(const char *vsPath, const char *fsPath) {
+  assert(vsPath != NULL && "invalid arg vsPath: cannot be NULL");
+  assert(fsPath != NULL && "invalid arg fsPath: cannot be NULL");
+  Shader shader = {.viewProjLocation = -1};
+  const char *files[] = {vsPath, fsPath};
+  uint64_t hash = 0;
+  bool remembered = false;
+  bool loaded = false;
+
+  // Both paths make the key, a newline cannot be part of either
+  size_t vsLength = strlen(vsPath);
+  size_t fsLength = strlen(fsPath);
+  char *key = malloc(vsLength + fsLength + 2);
+  if (key == NULL) {
+    shader.status = E_CANNOT_LOAD_FILE;
+    return shader;
+  }
+  memcpy(key, vsPath, vsLength);
+  key[vsLength] = '\n';
+  memcpy(key + vsLength + 1, fsPath, fsLength + 1);
+
+  if (!ResolveHash(RESOURCE_SHADER, key, files, 2, &hash, &remembered)) {
+    shader.status = E_CANNOT_LOAD_FILE;
+    goto terminate;
+  }
+
+  CacheEntry *entry = FindEntry(RESOURCE_SHADER, hash);
+  if (entry != NULL) {
+    entry->refs += 1;
+    shader = entry->shader;
+    loaded = true;
+    goto terminate;
+  }
+
+  // AppLoadShader already releases the program when it fails
+  shader = AppLoadShader(vsPath, fsPath);
+  if (shader.status != SUCCESS) {
+    shader.spId = 0;
+    goto terminate;
+  }
+
+  entry = AddEntry(RESOURCE_SHADER, hash);
+  if (entry == NULL) {
+    AppDestroyShader(shader);
+    shader = (Shader){.status = E_SHADER_LINK_ERROR, .viewProjLocation = -1};
+    goto terminate;
+  }
+  entry->shader = shader;
+  loaded = true;
+
+terminate:
+  if (loaded && !remembered) {
+    RememberHash(RESOURCE_SHADER, key, hash);
+  }
+
+  free(key);
+  return shader;
+}
+
+void AppReleaseShader(Shader shader) {
+  for (unsigned i = 0; i < cache.entryCount; i++) {
+    CacheEntry *entry = &cache.entries[i];
+    if (entry->kind != RESOURCE_SHADER || entry->shader.spId != shader.spId) {
+      continue;
+    }
+
+    entry->refs -= 1;
+    if (entry->refs == 0) {
+      AppDestroyShader(entry->shader);
+      RemoveEntry(entry);
+    }
+    return;
+  }
+
+  assert(false && "invalid arg shader: not acquired from the cache");
+}
+
+void CacheShutdown() {
+  for (unsigned i = 0; i < cache.pathCount; i++) {
+    free(cache.paths[i].key);
+  }
+
+  free(cache.paths);
+  free(cache.entries);
+  cache = (Cache){0};
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "app.h"
+
+// Standard libraries
+#include <stdint.h>
+
+// Load a texture whose file contents hash to sourceHash with AssetHash, so
+// its payload cache key does not hash the file again. Defined by app.c.
+Texture CacheLoadTexture(const char *texPath, uint64_t sourceHash);
+
+// Forget every cached resource, used by AppClose after the GL context is gone.
+void CacheShutdown();
@@ -0,0 +1,175 @@
+#include "jobs.h"
+
+// Standard libraries
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define JOBS_MAX_THREADS 32
+
+typedef struct {
+  JobFn fn;
+  void *arg;
+  JobGroup *group;
+} Job;
+
+typedef struct {
+  bool running;
+  bool stopping;
+  int threadCount;
+  pthread_t threads[JOBS_MAX_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t hasWork;
+  pthread_cond_t jobDone;
+  Job *queue;
+  int capacity;
+  int head;
+  int count;
+} JobPool;
+
+static JobPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .hasWork = PTHREAD_COND_INITIALIZER,
+    .jobDone = PTHREAD_COND_INITIALIZER,
+};
+
+// Pop the next job, pool.lock must be held.
+static bool PopJob(Job *job) {
+  if (pool.count == 0) {
+    return false;
+  }
+
+  *job = pool.queue[pool.head];
+  pool.head = (pool.head + 1) % pool.capacity;
+  pool.count -= 1;
+  return true;
+}
+
+// Run a job without the lock and mark it as done, pool.lock must be held.
+static void RunJob(Job job) {
+  pthread_mutex_unlock(&pool.lock);
+  job.fn(job.arg);
+  pthread_mutex_lock(&pool.lock);
+
+  if (job.group != NULL) {
+    job.group->pending -= 1;
+  }
+  pthread_cond_broadcast(&pool.jobDone);
+}
+
+static void *WorkerMain(void *unused) {
+  (void)unused;
+  Job job = {0};
+
+  pthread_mutex_lock(&pool.lock);
+  while (!pool.stopping) {
+    if (!PopJob(&job)) {
+      pthread_cond_wait(&pool.hasWork, &pool.lock);
+      continue;
+    }
+
+    RunJob(job);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+bool JobsInit(int threadCount) {
+  assert(!pool.running && "invalid state: job pool already running");
+  if (threadCount <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cores > 1 ? (int)cores - 1 : 1;
+  }
+
+  if (threadCount > JOBS_MAX_THREADS) {
+    threadCount = JOBS_MAX_THREADS;
+  }
+
+  pool.stopping = false;
+  pool.threadCount = 0;
+  for (int i = 0; i < threadCount; i++) {
+    if (pthread_create(&pool.threads[i], NULL, WorkerMain, NULL) != 0) {
+      break;
+    }
+    pool.threadCount += 1;
+  }
+
+  pool.running = pool.threadCount > 0;
+  return pool.running;
+}
+
+void JobsShutdown() {
+  if (!pool.running) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  pthread_cond_broadcast(&pool.hasWork);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 0; i < pool.threadCount; i++) {
+    pthread_join(pool.threads[i], NULL);
+  }
+
+  free(pool.queue);
+  pool.queue = NULL;
+  pool.capacity = 0;
+  pool.head = 0;
+  pool.count = 0;
+  pool.threadCount = 0;
+  pool.running = false;
+}
+
+int JobsThreadCount() { return pool.threadCount; }
+
+void JobsSubmit(JobFn fn, void *arg, JobGroup *group) {
+  assert(fn != NULL && "invalid arg fn: cannot be NULL");
+  if (!pool.running) {
+    fn(arg);
+    return;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  if (pool.count == pool.capacity) {
+    int capacity = pool.capacity == 0 ? 64 : pool.capacity * 2;
+    Job *queue = calloc(capacity, sizeof(Job));
+    assert(queue != NULL && "out of memory: cannot grow job queue");
+    for (int i = 0; i < pool.count; i++) {
+      queue[i] = pool.queue[(pool.head + i) % pool.capacity];
+    }
+
+    free(pool.queue);
+    pool.queue = queue;
+    pool.capacity = capacity;
+    pool.head = 0;
+  }
+
+  int tail = (pool.head + pool.count) % pool.capacity;
+  pool.queue[tail] = (Job){.fn = fn, .arg = arg, .group = group};
+  pool.count += 1;
+  if (group != NULL) {
+    group->pending += 1;
+  }
+
+  pthread_cond_signal(&pool.hasWork);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+void JobsWait(JobGroup *group) {
+  assert(group != NULL && "invalid arg group: cannot be NULL");
+  Job job = {0};
+
+  pthread_mutex_lock(&pool.lock);
+  while (group->pending > 0) {
+    // Help instead of sleeping, so waiting from a worker cannot deadlock.
+    if (PopJob(&job)) {
+      RunJob(job);
+      continue;
+    }
+
+    pthread_cond_wait(&pool.jobDone, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+}
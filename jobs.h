@@ -0,0 +1,26 @@
+#pragma once
+#include <stdbool.h>
+
+// A function to be run by a worker thread.
+typedef void (*JobFn)(void *arg);
+
+// Counts pending jobs so a caller can wait for a set of them.
+typedef struct {
+  int pending;
+} JobGroup;
+
+// Start the worker pool, when threadCount is 0 use one thread per core minus
+// the calling thread.
+bool JobsInit(int threadCount);
+
+// Stop the worker pool, jobs that did not start yet are dropped.
+void JobsShutdown();
+
+// Number of running worker threads.
+int JobsThreadCount();
+
+// Queue a job, group may be NULL. Runs inline if the pool is not running.
+void JobsSubmit(JobFn fn, void *arg, JobGroup *group);
+
+// Wait until every job of group is done, running queued jobs meanwhile.
+void JobsWait(JobGroup *group);
@@ -1,12 +1,52 @@
 #include "app.h"
 
+// Standard libraries
+#include <math.h>
+
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 800
 #define WINDOW_TITLE "SimpleKTX"
 
-#define PLANE_VS_PATH "assets/plane_vs.glsl"
+#define PLANE_VS_PATH "assets/plane_instanced_vs.glsl"
 #define PLANE_FS_PATH "assets/plane_fs.glsl"
 #define PLANE_TEXTURE "assets/plane_tex.ktx"
+#define ASSETS_BUNDLE "assets.bundle"
+
+// Planes per side of the field and the distance between them, the camera
+// sees a few of them at a time.
+#define FIELD_SIDE 100
+#define FIELD_SPACING 0.25f
+#define VIEW_HALF_SIZE 1.0f
+
+// State the update thread hands to the render thread each frame.
+typedef struct {
+  Mat4 viewProj;
+} Snapshot;
+
+typedef struct {
+  float time;
+} Camera;
+
+static void Update(void *user, void *snapshot, float deltaTime) {
+  Camera *camera = user;
+  Snapshot *next = snapshot;
+  camera->time += deltaTime;
+
+  // Pan across the field, the scene culls the planes out of view
+  float reach = 0.5f * FIELD_SIDE * FIELD_SPACING - VIEW_HALF_SIZE;
+  float x = reach * sinf(0.2f * camera->time);
+  float y = reach * sinf(0.13f * camera->time);
+  next->viewProj =
+      AppMat4Ortho(x - VIEW_HALF_SIZE, x + VIEW_HALF_SIZE, y - VIEW_HALF_SIZE,
+                   y + VIEW_HALF_SIZE, -1.0f, 1.0f);
+}
+
+static void Render(void *user, const void *snapshot) {
+  (void)user;
+  const Snapshot *frame = snapshot;
+  AppSubmitScene(frame->viewProj);
+  AppFlush();
+}
 
 int main() {
   StatusCode status = AppInit(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE);
@@ -15,15 +55,18 @@ int main() {
     return Exit(status);
   }
 
-  Shader shader = AppLoadShader(PLANE_VS_PATH, PLANE_FS_PATH);
+  // Loose files under assets/ are used when there is no bundle
+  AppMountBundle(ASSETS_BUNDLE);
+
+  Shader shader = AppAcquireShader(PLANE_VS_PATH, PLANE_FS_PATH);
   if (shader.status != SUCCESS) {
     AppClose();
     return Exit(shader.status);
   }
 
-  // Make and upload model & texture
-  Model model = AppMakePlane(0.5f);
-  Texture texture = AppLoadTexture(PLANE_TEXTURE);
+  // Make and upload model, the texture is uploaded while rendering
+  Model model = AppMakePlane(0.1f);
+  Texture texture = AppLoadTextureAsync(PLANE_TEXTURE);
   if (texture.status != SUCCESS) {
     AppClose();
     return Exit(texture.status);
@@ -33,16 +76,27 @@ int main() {
   model.shader = shader;
   model.texture = texture;
 
-  // Main loop
-  while (!AppShouldClose()) {
-    AppBeginFrame();
-    { // Render entities
-      AppRenderModel(model);
+  // Lay a field of planes, only the render thread reads the scene later
+  float origin = -0.5f * (FIELD_SIDE - 1) * FIELD_SPACING;
+  for (int y = 0; y < FIELD_SIDE; y++) {
+    for (int x = 0; x < FIELD_SIDE; x++) {
+      AppSceneAdd(model, AppMat4Translation(origin + x * FIELD_SPACING,
+                                            origin + y * FIELD_SPACING, 0.0f));
     }
-    AppEndFrame();
   }
 
+  // Main loop, input and update run apart from rendering
+  Camera camera = {0};
+  status = AppRunPipeline(&(FramePipeline){
+      .update = Update,
+      .render = Render,
+      .user = &camera,
+      .snapshotSize = sizeof(Snapshot),
+  });
+
   AppDestroyModel(model);
+  AppReleaseShader(shader);
+  AppDestroyTexture(texture);
   AppClose();
   return Exit(status);
 }
@@ -0,0 +1,269 @@
+#include "memstats.h"
+
+// Standard libraries
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  uintptr_t handle;
+  MemoryRecord record;
+} Allocation;
+
+typedef struct {
+  pthread_mutex_t lock;
+  Allocation *allocations;
+  unsigned count;
+  unsigned capacity;
+  // Open addressed index of allocations by category and handle, each bucket
+  // holds an allocation index plus one or 0 when empty
+  unsigned *buckets;
+  unsigned bucketCount;
+  unsigned dumpInterval;
+  unsigned long frame;
+} Memory;
+
+static Memory memory = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *categoryNames[MEMORY_CATEGORY_COUNT] = {
+    [MEMORY_GPU_TEXTURE] = "gpu_texture",
+    [MEMORY_GPU_BUFFER] = "gpu_buffer",
+    [MEMORY_GPU_PROGRAM] = "gpu_program",
+    [MEMORY_CPU_TEXTURE] = "cpu_texture",
+};
+
+static unsigned HashAllocation(MemoryCategory category, uintptr_t handle) {
+  uint64_t key = (uint64_t)handle * MEMORY_CATEGORY_COUNT + category;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return (unsigned)key;
+}
+
+// Find the bucket of an allocation or the empty one it would go in,
+// memory.lock must be held and there must be buckets.
+static unsigned FindBucket(MemoryCategory category, uintptr_t handle) {
+  unsigned mask = memory.bucketCount - 1;
+  unsigned bucket = HashAllocation(category, handle) & mask;
+  while (memory.buckets[bucket] != 0) {
+    const Allocation *allocation =
+        &memory.allocations[memory.buckets[bucket] - 1];
+    if (allocation->handle == handle &&
+        allocation->record.category == category) {
+      break;
+    }
+    bucket = (bucket + 1) & mask;
+  }
+
+  return bucket;
+}
+
+// Find an allocation, memory.lock must be held. Returns -1 if not tracked.
+static int FindAllocation(MemoryCategory category, uintptr_t handle) {
+  if (memory.bucketCount == 0) {
+    return -1;
+  }
+
+  return (int)memory.buckets[FindBucket(category, handle)] - 1;
+}
+
+// Rebuild the index with at least twice as many buckets as allocations fit,
+// so it stays at most half full. memory.lock must be held.
+static bool GrowBuckets(unsigned capacity) {
+  unsigned bucketCount = 16;
+  while (bucketCount < capacity * 2) {
+    bucketCount *= 2;
+  }
+
+  unsigned *buckets = calloc(bucketCount, sizeof(unsigned));
+  if (buckets == NULL) {
+    return false;
+  }
+
+  free(memory.buckets);
+  memory.buckets = buckets;
+  memory.bucketCount = bucketCount;
+  for (unsigned i = 0; i < memory.count; i++) {
+    const Allocation *allocation = &memory.allocations[i];
+    unsigned bucket =
+        FindBucket(allocation->record.category, allocation->handle);
+    memory.buckets[bucket] = i + 1;
+  }
+
+  return true;
+}
+
+// Empty a bucket, shifting back the ones after it that probed past it.
+static void RemoveBucket(unsigned hole) {
+  unsigned mask = memory.bucketCount - 1;
+  for (unsigned next = (hole + 1) & mask; memory.buckets[next] != 0;
+       next = (next + 1) & mask) {
+    const Allocation *allocation =
+        &memory.allocations[memory.buckets[next] - 1];
+    unsigned home =
+        HashAllocation(allocation->record.category, allocation->handle) &
+        mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      memory.buckets[hole] = memory.buckets[next];
+      hole = next;
+    }
+  }
+
+  memory.buckets[hole] = 0;
+}
+
+void MemoryTrack(MemoryCategory category, uintptr_t handle, size_t bytes,
+                 unsigned levels, GLenum internalFormat, const char *path) {
+  assert(category < MEMORY_CATEGORY_COUNT &&
+         "invalid arg category: outside range");
+  pthread_mutex_lock(&memory.lock);
+  int index = FindAllocation(category, handle);
+  if (index < 0 && memory.count == memory.capacity) {
+    unsigned capacity = memory.capacity == 0 ? 64 : memory.capacity * 2;
+    Allocation *allocations =
+        realloc(memory.allocations, capacity * sizeof(Allocation));
+    if (allocations == NULL) {
+      // Losing a record only makes the stats less accurate
+      pthread_mutex_unlock(&memory.lock);
+      return;
+    }
+
+    memory.allocations = allocations;
+    memory.capacity = capacity;
+  }
+
+  if (index < 0 && (memory.count + 1) * 2 > memory.bucketCount &&
+      !GrowBuckets(memory.capacity)) {
+    pthread_mutex_unlock(&memory.lock);
+    return;
+  }
+
+  if (index < 0) {
+    index = (int)memory.count++;
+    memory.buckets[FindBucket(category, handle)] = (unsigned)index + 1;
+  }
+
+  Allocation *allocation = &memory.allocations[index];
+  allocation->handle = handle;
+  allocation->record = (MemoryRecord){
+      .category = category,
+      .bytes = bytes,
+      .levels = levels,
+      .internalFormat = internalFormat,
+  };
+  if (path != NULL) {
+    snprintf(allocation->record.path, MEMORY_PATH_SIZE, "%s", path);
+  }
+  pthread_mutex_unlock(&memory.lock);
+}
+
+void MemoryUntrack(MemoryCategory category, uintptr_t handle) {
+  pthread_mutex_lock(&memory.lock);
+  int index = FindAllocation(category, handle);
+  if (index >= 0) {
+    // The last allocation fills the gap, its bucket follows it
+    RemoveBucket(FindBucket(category, handle));
+    Allocation *last = &memory.allocations[--memory.count];
+    if ((unsigned)index != memory.count) {
+      memory.buckets[FindBucket(last->record.category, last->handle)] =
+          (unsigned)index + 1;
+      memory.allocations[index] = *last;
+    }
+  }
+  pthread_mutex_unlock(&memory.lock);
+}
+
+// Sort allocations from the largest to the smallest.
+static int CompareAllocations(const void *a, const void *b) {
+  size_t lhs = ((const Allocation *)a)->record.bytes;
+  size_t rhs = ((const Allocation *)b)->record.bytes;
+  return (lhs < rhs) - (lhs > rhs);
+}
+
+MemoryStats AppGetMemoryStats() {
+  MemoryStats stats = {0};
+
+  // Keep the largest records sorted in the spare last entry and above
+  MemoryRecord top[MEMORY_TOP_COUNT + 1];
+  int topCount = 0;
+  pthread_mutex_lock(&memory.lock);
+  for (unsigned i = 0; i < memory.count; i++) {
+    const MemoryRecord *record = &memory.allocations[i].record;
+    stats.bytes[record->category] += record->bytes;
+    stats.count[record->category] += 1;
+
+    int position = topCount;
+    while (position > 0 && top[position - 1].bytes < record->bytes) {
+      top[position] = top[position - 1];
+      position -= 1;
+    }
+    top[position] = *record;
+    topCount += topCount < MEMORY_TOP_COUNT;
+  }
+  pthread_mutex_unlock(&memory.lock);
+
+  memcpy(stats.top, top, topCount * sizeof(MemoryRecord));
+  stats.topCount = topCount;
+  return stats;
+}
+
+// Print a record as a single line.
+static void PrintRecord(const MemoryRecord *record) {
+  fprintf(stderr, "  %-12s %10zu bytes  levels %2u  format 0x%04x  %s\n",
+          categoryNames[record->category], record->bytes, record->levels,
+          record->internalFormat,
+          record->path[0] != '\0' ? record->path : "-");
+}
+
+void AppDumpMemoryStats() {
+  MemoryStats stats = AppGetMemoryStats();
+  size_t total = 0;
+  fprintf(stderr, "memory:\n");
+  for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    fprintf(stderr, "  %-12s %10zu bytes in %u\n", categoryNames[i],
+            stats.bytes[i], stats.count[i]);
+    total += stats.bytes[i];
+  }
+  fprintf(stderr, "  %-12s %10zu bytes\n", "total", total);
+
+  fprintf(stderr, "largest:\n");
+  for (int i = 0; i < stats.topCount; i++) {
+    PrintRecord(&stats.top[i]);
+  }
+}
+
+void AppSetMemoryDumpInterval(unsigned frames) {
+  memory.dumpInterval = frames;
+}
+
+void MemoryBeginFrame() {
+  memory.frame += 1;
+  if (memory.dumpInterval != 0 && memory.frame % memory.dumpInterval == 0) {
+    AppDumpMemoryStats();
+  }
+}
+
+void MemoryShutdown() {
+  pthread_mutex_lock(&memory.lock);
+  if (memory.count > 0) {
+    fprintf(stderr, "memory: %u allocations were not freed\n", memory.count);
+    qsort(memory.allocations, memory.count, sizeof(Allocation),
+          CompareAllocations);
+    for (unsigned i = 0; i < memory.count; i++) {
+      PrintRecord(&memory.allocations[i].record);
+    }
+  }
+
+  free(memory.allocations);
+  free(memory.buckets);
+  memory.allocations = NULL;
+  memory.count = 0;
+  memory.capacity = 0;
+  memory.buckets = NULL;
+  memory.bucketCount = 0;
+  pthread_mutex_unlock(&memory.lock);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "app.h"
+
+// Standard libraries
+#include <stdint.h>
+
+// Start tracking an allocation or update it, handle identifies it within its
+// category (a GL name or a slot number). path may be NULL.
+void MemoryTrack(MemoryCategory category, uintptr_t handle, size_t bytes,
+                 unsigned levels, GLenum internalFormat, const char *path);
+
+// Stop tracking an allocation, unknown handles are ignored.
+void MemoryUntrack(MemoryCategory category, uintptr_t handle);
+
+// Count a frame and dump the stats when the interval is due, used by
+// AppBeginFrame.
+void MemoryBeginFrame();
+
+// Report allocations nobody freed and forget them all, used by AppClose.
+void MemoryShutdown();
@@ -0,0 +1,771 @@
+#include "mesh.h"
+#include "app.h"
+#include "asset.h"
+#include "memstats.h"
+
+// Standard libraries
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GLAD
+#include <glad/glad.h>
+
+// Vertices the optimizer assumes the post transform cache holds.
+#define MESH_CACHE_SIZE 32
+
+// Valences up to this use a precomputed score.
+#define MESH_MAX_VALENCE 64
+
+// Half float positions need at least this many steps across the largest
+// extent of a mesh, float ones are used otherwise.
+#define MESH_HALF_STEPS 1024
+
+// Quantized vertex, half the size of the float one: half float positions,
+// unorm8 colors and unorm16 or half float UVs. Meshes half floats cannot hold
+// use MeshVertexWide.
+typedef struct {
+  uint16_t position[4];
+  uint8_t color[4];
+  uint16_t uv[2];
+} MeshVertex;
+
+// Vertex of meshes too large or too far from the origin for half floats.
+typedef struct {
+  float position[3];
+  uint8_t color[4];
+  uint16_t uv[2];
+} MeshVertexWide;
+
+typedef struct {
+  float cache[MESH_CACHE_SIZE];
+  float valence[MESH_MAX_VALENCE];
+} ScoreTable;
+
+typedef struct {
+  unsigned first;
+  unsigned live;
+  int cachePos;
+  float score;
+} CacheVertex;
+
+static ScoreTable scoreTable = {0};
+
+// Fill the score table once, scores follow Forsyth's suggested constants.
+static void InitScoreTable() {
+  if (scoreTable.valence[1] != 0.0f) {
+    return;
+  }
+
+  for (int i = 0; i < MESH_CACHE_SIZE; i++) {
+    // The last triangle's vertices score a bit lower to avoid strips
+    float position = 1.0f - (float)(i - 3) / (MESH_CACHE_SIZE - 3);
+    scoreTable.cache[i] = i < 3 ? 0.75f : powf(position, 1.5f);
+  }
+
+  for (int i = 1; i < MESH_MAX_VALENCE; i++) {
+    scoreTable.valence[i] = 2.0f / sqrtf((float)i);
+  }
+}
+
+// Vertices with few triangles left are boosted so they finish early.
+static float VertexScore(const CacheVertex *vertex) {
+  if (vertex->live == 0) {
+    return -1.0f;
+  }
+
+  float score = vertex->cachePos >= 0 ? scoreTable.cache[vertex->cachePos] : 0;
+  if (vertex->live < MESH_MAX_VALENCE) {
+    return score + scoreTable.valence[vertex->live];
+  }
+
+  return score + 2.0f / sqrtf((float)vertex->live);
+}
+
+void MeshOptimizeVertexCache(unsigned *indices, unsigned indexCount,
+                             unsigned vertexCount) {
+  assert(indices != NULL && "invalid arg indices: cannot be NULL");
+  assert(indexCount % 3 == 0 && "invalid arg indexCount: not triangles");
+  unsigned triangleCount = indexCount / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  InitScoreTable();
+  CacheVertex *vertices = calloc(vertexCount, sizeof(CacheVertex));
+  unsigned *adjacency = malloc(indexCount * sizeof(unsigned));
+  float *triangleScores = malloc(triangleCount * sizeof(float));
+  unsigned *output = malloc(indexCount * sizeof(unsigned));
+  if (vertices == NULL || adjacency == NULL || triangleScores == NULL ||
+      output == NULL) {
+    // Optimizing is optional, the mesh is still valid as is
+    goto terminate;
+  }
+
+  // Triangles of each vertex, packed so the live ones come first
+  for (unsigned i = 0; i < indexCount; i++) {
+    assert(indices[i] < vertexCount && "invalid arg indices: out of range");
+    vertices[indices[i]].live += 1;
+  }
+
+  unsigned offset = 0;
+  for (unsigned v = 0; v < vertexCount; v++) {
+    vertices[v].first = offset;
+    offset += vertices[v].live;
+    vertices[v].live = 0;
+    vertices[v].cachePos = -1;
+  }
+
+  for (unsigned i = 0; i < indexCount; i++) {
+    CacheVertex *vertex = &vertices[indices[i]];
+    adjacency[vertex->first + vertex->live++] = i / 3;
+  }
+
+  for (unsigned v = 0; v < vertexCount; v++) {
+    vertices[v].score = VertexScore(&vertices[v]);
+  }
+
+  unsigned best = 0;
+  for (unsigned t = 0; t < triangleCount; t++) {
+    const unsigned *corners = &indices[t * 3];
+    triangleScores[t] = vertices[corners[0]].score +
+                        vertices[corners[1]].score +
+                        vertices[corners[2]].score;
+    if (triangleScores[t] > triangleScores[best]) {
+      best = t;
+    }
+  }
+
+  // Three extra entries hold the vertices pushed out by the last triangle
+  unsigned cache[MESH_CACHE_SIZE + 3];
+  unsigned cacheCount = 0;
+  unsigned cursor = 0;
+  for (unsigned emitted = 0; emitted < triangleCount; emitted++) {
+    if (best == ~0u) {
+      // Dead end, continue with the next triangle in input order
+      while (triangleScores[cursor] < 0.0f) {
+        cursor += 1;
+      }
+      best = cursor;
+    }
+
+    const unsigned *corners = &indices[best * 3];
+    memcpy(&output[emitted * 3], corners, 3 * sizeof(unsigned));
+    triangleScores[best] = -1.0f;
+
+    unsigned nextCache[MESH_CACHE_SIZE + 3];
+    unsigned nextCount = 0;
+    for (int c = 0; c < 3; c++) {
+      CacheVertex *vertex = &vertices[corners[c]];
+      for (unsigned i = 0; i < vertex->live; i++) {
+        if (adjacency[vertex->first + i] == best) {
+          adjacency[vertex->first + i] =
+              adjacency[vertex->first + vertex->live - 1];
+          vertex->live -= 1;
+          break;
+        }
+      }
+
+      bool cached = false;
+      for (unsigned i = 0; i < nextCount; i++) {
+        cached = cached || nextCache[i] == corners[c];
+      }
+      if (!cached) {
+        nextCache[nextCount++] = corners[c];
+      }
+    }
+
+    for (unsigned i = 0; i < cacheCount; i++) {
+      unsigned v = cache[i];
+      if (v != corners[0] && v != corners[1] && v != corners[2]) {
+        nextCache[nextCount++] = v;
+      }
+    }
+
+    // Rescore what moved in the cache and the triangles around it
+    cacheCount = nextCount < MESH_CACHE_SIZE ? nextCount : MESH_CACHE_SIZE;
+    best = ~0u;
+    float bestScore = -1.0f;
+    for (unsigned i = 0; i < nextCount; i++) {
+      CacheVertex *vertex = &vertices[nextCache[i]];
+      vertex->cachePos = i < MESH_CACHE_SIZE ? (int)i : -1;
+      vertex->score = VertexScore(vertex);
+    }
+
+    for (unsigned i = 0; i < nextCount; i++) {
+      CacheVertex *vertex = &vertices[nextCache[i]];
+      for (unsigned a = 0; a < vertex->live; a++) {
+        unsigned t = adjacency[vertex->first + a];
+        const unsigned *around = &indices[t * 3];
+        triangleScores[t] = vertices[around[0]].score +
+                            vertices[around[1]].score +
+                            vertices[around[2]].score;
+        if (triangleScores[t] > bestScore) {
+          bestScore = triangleScores[t];
+          best = t;
+        }
+      }
+    }
+
+    memcpy(cache, nextCache, cacheCount * sizeof(unsigned));
+  }
+
+  memcpy(indices, output, indexCount * sizeof(unsigned));
+
+terminate:
+  free(vertices);
+  free(adjacency);
+  free(triangleScores);
+  free(output);
+}
+
+unsigned MeshOptimizeVertexFetch(unsigned *indices, unsigned indexCount,
+                                 unsigned vertexCount, unsigned *remap) {
+  assert(indices != NULL && "invalid arg indices: cannot be NULL");
+  assert(remap != NULL && "invalid arg remap: cannot be NULL");
+  memset(remap, 0xff, vertexCount * sizeof(unsigned));
+
+  unsigned used = 0;
+  for (unsigned i = 0; i < indexCount; i++) {
+    assert(indices[i] < vertexCount && "invalid arg indices: out of range");
+    if (remap[indices[i]] == ~0u) {
+      remap[indices[i]] = used++;
+    }
+    indices[i] = remap[indices[i]];
+  }
+
+  return used;
+}
+
+float MeshCacheMissRatio(const unsigned *indices, unsigned indexCount,
+                         unsigned vertexCount, unsigned cacheSize) {
+  assert(indices != NULL && "invalid arg indices: cannot be NULL");
+  assert(cacheSize > 0 && "invalid arg cacheSize: must be positive");
+  if (indexCount < 3) {
+    return 0.0f;
+  }
+
+  // Each vertex remembers when it entered the FIFO
+  unsigned *entered = calloc(vertexCount, sizeof(unsigned));
+  if (entered == NULL) {
+    return 0.0f;
+  }
+
+  unsigned misses = 0;
+  for (unsigned i = 0; i < indexCount; i++) {
+    unsigned v = indices[i];
+    if (entered[v] == 0 || misses + 1 - entered[v] > cacheSize) {
+      misses += 1;
+      entered[v] = misses;
+    }
+  }
+
+  free(entered);
+  return (float)misses / (float)(indexCount / 3);
+}
+
+// Convert to half float rounding to nearest even.
+static uint16_t FloatToHalf(float value) {
+  uint32_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff) {
+    return (uint16_t)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+  }
+
+  if (exponent >= 31) {
+    return (uint16_t)(sign | 0x7c00);
+  }
+
+  int shift = 13;
+  uint32_t half = 0;
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return (uint16_t)sign;
+    }
+
+    // Denormal, the implicit one becomes explicit
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+  } else {
+    half = (uint32_t)exponent << 10;
+  }
+
+  // A carry out of the mantissa correctly bumps the exponent
+  uint32_t rest = mantissa & ((1u << shift) - 1);
+  uint32_t halfway = 1u << (shift - 1);
+  half += mantissa >> shift;
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    half += 1;
+  }
+
+  return (uint16_t)(sign | half);
+}
+
+static uint16_t FloatToUnorm16(float value) {
+  value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+  return (uint16_t)(value * 65535.0f + 0.5f);
+}
+
+static uint8_t FloatToUnorm8(float value) {
+  value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+  return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+// Check if every UV fits unorm16, tiled ones need half floats.
+static bool UvsAreNormalized(const MeshData *mesh) {
+  for (unsigned i = 0; mesh->uvs != NULL && i < mesh->vertexCount * 2; i++) {
+    if (mesh->uvs[i] < 0.0f || mesh->uvs[i] > 1.0f) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Check if half floats keep the detail of a mesh, their step grows with the
+// distance to the origin and they end at 65504.
+static bool BoundsFitHalf(const Bounds *bounds) {
+  float magnitude = 0.0f;
+  float extent = 0.0f;
+  for (int axis = 0; axis < 3; axis++) {
+    magnitude = fmaxf(magnitude, fmaxf(fabsf(bounds->min[axis]),
+                                       fabsf(bounds->max[axis])));
+    extent = fmaxf(extent, bounds->max[axis] - bounds->min[axis]);
+  }
+
+  if (magnitude == 0.0f) {
+    return true;
+  }
+
+  int exponent = 0;
+  frexpf(magnitude, &exponent);
+  float step = ldexpf(1.0f, exponent - 11);
+  return magnitude < 65504.0f && step * MESH_HALF_STEPS <= extent;
+}
+
+static MeshVertex QuantizeVertex(const MeshData *mesh, unsigned v,
+                                 bool unormUvs) {
+  MeshVertex vertex = {.color = {255, 255, 255, 255}};
+  for (int c = 0; c < 3; c++) {
+    vertex.position[c] = FloatToHalf(mesh->positions[v * 3 + c]);
+  }
+  vertex.position[3] = FloatToHalf(1.0f);
+
+  for (int c = 0; mesh->colors != NULL && c < 3; c++) {
+    vertex.color[c] = FloatToUnorm8(mesh->colors[v * 3 + c]);
+  }
+
+  for (int c = 0; mesh->uvs != NULL && c < 2; c++) {
+    float uv = mesh->uvs[v * 2 + c];
+    vertex.uv[c] = unormUvs ? FloatToUnorm16(uv) : FloatToHalf(uv);
+  }
+
+  return vertex;
+}
+
+// Upload a mesh, path names its buffers in memory stats and may be NULL.
+static Model MakeMesh(const MeshData *mesh, const char *path) {
+  assert(mesh != NULL && "invalid arg mesh: cannot be NULL");
+  assert(mesh->positions != NULL && "invalid arg mesh: positions are NULL");
+  assert(mesh->indices != NULL && "invalid arg mesh: indices are NULL");
+  assert(mesh->indexCount % 3 == 0 && "invalid arg mesh: not triangles");
+  Model model = {0};
+  unsigned *indices = malloc(mesh->indexCount * sizeof(unsigned));
+  unsigned *remap = malloc(mesh->vertexCount * sizeof(unsigned));
+  unsigned char *vertices = NULL;
+  if (indices == NULL || remap == NULL) {
+    model.status = E_CANNOT_CREATE_MESH;
+    goto terminate;
+  }
+
+  // Triangle order for the vertex cache first, then vertex order for fetch
+  memcpy(indices, mesh->indices, mesh->indexCount * sizeof(unsigned));
+  MeshOptimizeVertexCache(indices, mesh->indexCount, mesh->vertexCount);
+  unsigned vertexCount = MeshOptimizeVertexFetch(indices, mesh->indexCount,
+                                                 mesh->vertexCount, remap);
+
+  // Bounds cover the vertices triangles use
+  model.bounds = (Bounds){{INFINITY, INFINITY, INFINITY},
+                          {-INFINITY, -INFINITY, -INFINITY}};
+  for (unsigned v = 0; v < mesh->vertexCount; v++) {
+    for (int axis = 0; remap[v] != ~0u && axis < 3; axis++) {
+      float position = mesh->positions[v * 3 + axis];
+      model.bounds.min[axis] = fminf(model.bounds.min[axis], position);
+      model.bounds.max[axis] = fmaxf(model.bounds.max[axis], position);
+    }
+  }
+
+  bool halfPositions = BoundsFitHalf(&model.bounds);
+  size_t stride = halfPositions ? sizeof(MeshVertex) : sizeof(MeshVertexWide);
+  vertices = malloc(vertexCount * stride);
+  if (vertices == NULL) {
+    model.status = E_CANNOT_CREATE_MESH;
+    goto terminate;
+  }
+
+  bool unormUvs = UvsAreNormalized(mesh);
+  for (unsigned v = 0; v < mesh->vertexCount; v++) {
+    if (remap[v] == ~0u) {
+      continue;
+    }
+
+    MeshVertex vertex = QuantizeVertex(mesh, v, unormUvs);
+    if (halfPositions) {
+      memcpy(vertices + remap[v] * stride, &vertex, sizeof(vertex));
+    } else {
+      MeshVertexWide wide = {0};
+      memcpy(wide.position, &mesh->positions[v * 3], sizeof(wide.position));
+      memcpy(wide.color, vertex.color, sizeof(wide.color));
+      memcpy(wide.uv, vertex.uv, sizeof(wide.uv));
+      memcpy(vertices + remap[v] * stride, &wide, sizeof(wide));
+    }
+  }
+
+  // Narrow indices in place, 16 bits cover most meshes
+  size_t indexSize = sizeof(unsigned);
+  model.indexType = GL_UNSIGNED_INT;
+  if (vertexCount <= UINT16_MAX + 1) {
+    uint16_t *narrow = (uint16_t *)indices;
+    for (unsigned i = 0; i < mesh->indexCount; i++) {
+      narrow[i] = (uint16_t)indices[i];
+    }
+    indexSize = sizeof(uint16_t);
+    model.indexType = GL_UNSIGNED_SHORT;
+  }
+
+  glGenVertexArrays(1, &model.vao);
+  glGenBuffers(1, &model.vbo);
+  glGenBuffers(1, &model.ebo);
+
+  glBindVertexArray(model.vao);
+  glBindBuffer(GL_ARRAY_BUFFER, model.vbo);
+  glBufferData(GL_ARRAY_BUFFER, vertexCount * stride, vertices,
+               GL_STATIC_DRAW);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indexCount * indexSize, indices,
+               GL_STATIC_DRAW);
+
+  // position attribute
+  glVertexAttribPointer(0, 3, halfPositions ? GL_HALF_FLOAT : GL_FLOAT,
+                        GL_FALSE, stride,
+                        (void *)(halfPositions
+                                     ? offsetof(MeshVertex, position)
+                                     : offsetof(MeshVertexWide, position)));
+  glEnableVertexAttribArray(0);
+
+  // color attribute
+  glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                        (void *)(halfPositions
+                                     ? offsetof(MeshVertex, color)
+                                     : offsetof(MeshVertexWide, color)));
+  glEnableVertexAttribArray(1);
+
+  // texture coord attribute
+  glVertexAttribPointer(2, 2, unormUvs ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT,
+                        unormUvs ? GL_TRUE : GL_FALSE, stride,
+                        (void *)(halfPositions ? offsetof(MeshVertex, uv)
+                                               : offsetof(MeshVertexWide, uv)));
+  glEnableVertexAttribArray(2);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  model.indexCount = mesh->indexCount;
+  MemoryTrack(MEMORY_GPU_BUFFER, model.vbo, vertexCount * stride, 0, 0, path);
+  MemoryTrack(MEMORY_GPU_BUFFER, model.ebo, mesh->indexCount * indexSize, 0,
+              0, path);
+
+terminate:
+  free(indices);
+  free(remap);
+  free(vertices);
+  return model;
+}
+
+Model AppMakeMesh(const MeshData *mesh) { return MakeMesh(mesh, NULL); }
+
+typedef struct {
+  float *positions;
+  float *colors;
+  float *uvs;
+  unsigned positionCount;
+  unsigned positionCapacity;
+  unsigned colorCapacity;
+  unsigned uvCount;
+  unsigned uvCapacity;
+  bool hasColors;
+
+  // Each corner is a pair of position and uv index
+  unsigned *corners;
+  unsigned cornerCount;
+  unsigned cornerCapacity;
+} ObjData;
+
+// Make room for count more elements of size in a growable array.
+static bool Reserve(void **data, unsigned *capacity, unsigned count,
+                    size_t size) {
+  if (count <= *capacity) {
+    return true;
+  }
+
+  unsigned next = *capacity == 0 ? 256 : *capacity;
+  while (next < count) {
+    next *= 2;
+  }
+
+  void *grown = realloc(*data, next * size);
+  if (grown == NULL) {
+    return false;
+  }
+
+  *data = grown;
+  *capacity = next;
+  return true;
+}
+
+// Resolve a one based or negative relative OBJ index, ~0u if invalid.
+static unsigned ObjIndex(long index, unsigned count) {
+  if (index > 0 && (unsigned long)index <= count) {
+    return (unsigned)index - 1;
+  }
+
+  if (index < 0 && (unsigned long)-index <= count) {
+    return count - (unsigned)-index;
+  }
+
+  return ~0u;
+}
+
+static bool ParseObjVertex(ObjData *obj, const char *line) {
+  unsigned count = obj->positionCount + 1;
+  if (!Reserve((void **)&obj->positions, &obj->positionCapacity, count,
+               3 * sizeof(float)) ||
+      !Reserve((void **)&obj->colors, &obj->colorCapacity, count,
+               3 * sizeof(float))) {
+    return false;
+  }
+
+  // Some exporters append a vertex color after the position
+  float *position = &obj->positions[obj->positionCount * 3];
+  float *color = &obj->colors[obj->positionCount * 3];
+  color[0] = color[1] = color[2] = 1.0f;
+  int read = sscanf(line, "%f %f %f %f %f %f", &position[0], &position[1],
+                    &position[2], &color[0], &color[1], &color[2]);
+  if (read < 3) {
+    return false;
+  }
+
+  obj->hasColors = obj->hasColors || read == 6;
+  obj->positionCount = count;
+  return true;
+}
+
+static bool ParseObjUv(ObjData *obj, const char *line) {
+  if (!Reserve((void **)&obj->uvs, &obj->uvCapacity, obj->uvCount + 1,
+               2 * sizeof(float))) {
+    return false;
+  }
+
+  // OBJ puts the UV origin at the bottom left, textures start at the top
+  float *uv = &obj->uvs[obj->uvCount * 2];
+  uv[1] = 0.0f;
+  if (sscanf(line, "%f %f", &uv[0], &uv[1]) < 1) {
+    return false;
+  }
+  uv[1] = 1.0f - uv[1];
+  obj->uvCount += 1;
+  return true;
+}
+
+// Match a line starting with keyword and whitespace, returns the rest of the
+// line or NULL.
+static char *MatchObjKeyword(char *line, const char *keyword) {
+  size_t length = strlen(keyword);
+  if (strncmp(line, keyword, length) != 0 ||
+      (line[length] != ' ' && line[length] != '\t')) {
+    return NULL;
+  }
+
+  return line + length + 1;
+}
+
+// Parse a polygon and triangulate it as a fan.
+static bool ParseObjFace(ObjData *obj, char *line) {
+  // Polygons are fanned from their first corner as they are read
+  unsigned fan[3][2];
+  unsigned count = 0;
+  char *state = NULL;
+  for (char *token = strtok_r(line, " \t\r", &state); token != NULL;
+       token = strtok_r(NULL, " \t\r", &state)) {
+    unsigned *corner = fan[count < 2 ? count : 2];
+    char *end = NULL;
+    corner[0] = ObjIndex(strtol(token, &end, 10), obj->positionCount);
+    corner[1] = ~0u;
+    if (*end == '/' && end[1] != '/') {
+      corner[1] = ObjIndex(strtol(end + 1, NULL, 10), obj->uvCount);
+    }
+
+    if (corner[0] == ~0u) {
+      return false;
+    }
+
+    count += 1;
+    if (count < 3) {
+      continue;
+    }
+
+    if (!Reserve((void **)&obj->corners, &obj->cornerCapacity,
+                 obj->cornerCount + 3, 2 * sizeof(unsigned))) {
+      return false;
+    }
+
+    memcpy(&obj->corners[obj->cornerCount * 2], fan, sizeof(fan));
+    obj->cornerCount += 3;
+    memcpy(fan[1], fan[2], sizeof(fan[1]));
+  }
+
+  return count >= 3;
+}
+
+static bool ParseObj(const Asset *asset, ObjData *obj) {
+  const char *text = (const char *)asset->data;
+  size_t size = asset->size;
+  char *line = NULL;
+  unsigned lineCapacity = 0;
+  bool ok = true;
+
+  for (size_t start = 0; start < size;) {
+    size_t end = start;
+    while (end < size && text[end] != '\n') {
+      end += 1;
+    }
+
+    // Lines are copied to get a terminated string for the parsers
+    size_t length = end - start;
+    if (length >= UINT32_MAX ||
+        !Reserve((void **)&line, &lineCapacity, (unsigned)length + 1, 1)) {
+      ok = false;
+      goto terminate;
+    }
+    memcpy(line, text + start, length);
+    line[length] = '\0';
+    start = end + 1;
+
+    char *text = line + strspn(line, " \t");
+    char *rest = NULL;
+    if ((rest = MatchObjKeyword(text, "v")) != NULL) {
+      ok = ParseObjVertex(obj, rest);
+    } else if ((rest = MatchObjKeyword(text, "vt")) != NULL) {
+      ok = ParseObjUv(obj, rest);
+    } else if ((rest = MatchObjKeyword(text, "f")) != NULL) {
+      ok = ParseObjFace(obj, rest);
+    }
+
+    if (!ok) {
+      goto terminate;
+    }
+  }
+
+terminate:
+  free(line);
+  return ok && obj->cornerCount > 0;
+}
+
+// Build an indexed mesh from OBJ corners, sharing equal position/uv pairs.
+static Model MakeObjMesh(const ObjData *obj, const char *path) {
+  Model model = {.status = E_CANNOT_CREATE_MESH};
+  unsigned tableSize = 1;
+  while (tableSize < obj->cornerCount * 2) {
+    tableSize *= 2;
+  }
+
+  unsigned *table = malloc(tableSize * sizeof(unsigned));
+  unsigned *indices = malloc(obj->cornerCount * sizeof(unsigned));
+  unsigned *sources = malloc(obj->cornerCount * 2 * sizeof(unsigned));
+  float *positions = malloc(obj->cornerCount * 3 * sizeof(float));
+  float *colors = malloc(obj->cornerCount * 3 * sizeof(float));
+  float *uvs = calloc(obj->cornerCount * 2, sizeof(float));
+  if (table == NULL || indices == NULL || sources == NULL ||
+      positions == NULL || colors == NULL || uvs == NULL) {
+    goto terminate;
+  }
+
+  memset(table, 0xff, tableSize * sizeof(unsigned));
+  unsigned vertexCount = 0;
+  for (unsigned i = 0; i < obj->cornerCount; i++) {
+    const unsigned *corner = &obj->corners[i * 2];
+    uint64_t hash = AssetHash(ASSET_HASH_SEED, corner, 2 * sizeof(unsigned));
+    unsigned slot = (unsigned)hash & (tableSize - 1);
+    while (table[slot] != ~0u &&
+           memcmp(&sources[table[slot] * 2], corner, 2 * sizeof(unsigned))) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+
+    if (table[slot] == ~0u) {
+      unsigned v = vertexCount++;
+      table[slot] = v;
+      memcpy(&sources[v * 2], corner, 2 * sizeof(unsigned));
+      memcpy(&positions[v * 3], &obj->positions[corner[0] * 3],
+             3 * sizeof(float));
+      memcpy(&colors[v * 3], &obj->colors[corner[0] * 3], 3 * sizeof(float));
+      if (corner[1] != ~0u) {
+        memcpy(&uvs[v * 2], &obj->uvs[corner[1] * 2], 2 * sizeof(float));
+      }
+    }
+
+    indices[i] = table[slot];
+  }
+
+  MeshData mesh = {
+      .positions = positions,
+      .colors = obj->hasColors ? colors : NULL,
+      .uvs = obj->uvCount > 0 ? uvs : NULL,
+      .vertexCount = vertexCount,
+      .indices = indices,
+      .indexCount = obj->cornerCount,
+  };
+  model = MakeMesh(&mesh, path);
+
+terminate:
+  free(table);
+  free(indices);
+  free(sources);
+  free(positions);
+  free(colors);
+  free(uvs);
+  return model;
+}
+
+Model AppLoadMesh(const char *path) {
+  assert(path != NULL && "invalid arg path: cannot be NULL");
+  Model model = {.status = E_CANNOT_LOAD_FILE};
+  Asset asset = {0};
+  if (!AssetOpen(path, ASSET_READ_SEQUENTIAL, &asset)) {
+    fprintf(stderr, "cannot open mesh %s\n", path);
+    return model;
+  }
+
+  ObjData obj = {0};
+  AppTimerBegin("load");
+  if (ParseObj(&asset, &obj)) {
+    model = MakeObjMesh(&obj, path);
+  } else {
+    fprintf(stderr, "cannot parse mesh %s\n", path);
+    model.status = E_CANNOT_CREATE_MESH;
+  }
+  AppTimerEnd();
+
+  free(obj.positions);
+  free(obj.colors);
+  free(obj.uvs);
+  free(obj.corners);
+  AssetClose(&asset);
+  return model;
+}
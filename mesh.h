@@ -0,0 +1,16 @@
+#pragma once
+
+// Reorder triangles so consecutive ones reuse vertices still in the post
+// transform cache, with Tom Forsyth's linear speed vertex cache optimizer.
+void MeshOptimizeVertexCache(unsigned *indices, unsigned indexCount,
+                             unsigned vertexCount);
+
+// Renumber vertices in the order indices first use them so vertex fetches
+// walk memory forward. Writes the new index of each vertex to remap, ~0u for
+// unused ones, and returns how many vertices are used.
+unsigned MeshOptimizeVertexFetch(unsigned *indices, unsigned indexCount,
+                                 unsigned vertexCount, unsigned *remap);
+
+// Average vertex cache misses per triangle for a FIFO cache of cacheSize.
+float MeshCacheMissRatio(const unsigned *indices, unsigned indexCount,
+                         unsigned vertexCount, unsigned cacheSize);
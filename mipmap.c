@@ -0,0 +1,309 @@
+#include "mipmap.h"
+#include "jobs.h"
+
+// Standard libraries
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MIPMAP_AVX2
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Rows below this are not worth a job of their own.
+#define MIPMAP_BAND_ROWS 32
+#define MIPMAP_MAX_BANDS 64
+
+// Linear sums of four samples are bucketed by this shift to find their sRGB
+// encoding, buckets are narrower than the gap between two encodings.
+#define MIPMAP_ENCODE_SHIFT 6
+#define MIPMAP_ENCODE_SIZE ((4 * 65535 >> MIPMAP_ENCODE_SHIFT) + 1)
+
+// Averages count pixels of two rows and returns how many it did, the scalar
+// loop finishes the rest.
+typedef unsigned (*BoxRowFn)(const uint8_t *row0, const uint8_t *row1,
+                             uint8_t *dst, unsigned count);
+
+typedef struct {
+  pthread_once_t once;
+  BoxRowFn boxRow;
+  const char *kernelName;
+  // sRGB byte to linear in 16 bit fixed point
+  uint16_t toLinear[256];
+  // Smallest sum of four linear samples each sRGB byte encodes
+  uint32_t thresholds[257];
+  uint8_t encode[MIPMAP_ENCODE_SIZE];
+} Mipmap;
+
+static Mipmap mipmap = {
+    .once = PTHREAD_ONCE_INIT,
+};
+
+typedef struct {
+  const uint8_t *src;
+  unsigned width;
+  unsigned height;
+  uint8_t *dst;
+  unsigned firstRow;
+  unsigned lastRow;
+  bool srgb;
+} MipmapBand;
+
+static unsigned BoxRowNone(const uint8_t *row0, const uint8_t *row1,
+                           uint8_t *dst, unsigned count) {
+  (void)row0;
+  (void)row1;
+  (void)dst;
+  (void)count;
+  return 0;
+}
+
+#if defined(__SSE2__)
+// Four pixels per step, pairs are summed in 16 bits then rounded.
+static unsigned BoxRowSSE2(const uint8_t *row0, const uint8_t *row1,
+                           uint8_t *dst, unsigned count) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i two = _mm_set1_epi16(2);
+  unsigned x = 0;
+  for (; x + 4 <= count; x += 4) {
+    __m128i halves[2];
+    for (int half = 0; half < 2; half++) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(row0 + x * 8 + half * 16));
+      __m128i b = _mm_loadu_si128((const __m128i *)(row1 + x * 8 + half * 16));
+      __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                 _mm_unpacklo_epi8(b, zero));
+      __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                 _mm_unpackhi_epi8(b, zero));
+      __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                                  _mm_unpackhi_epi64(lo, hi));
+      halves[half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    }
+    _mm_storeu_si128((__m128i *)(dst + x * 4),
+                     _mm_packus_epi16(halves[0], halves[1]));
+  }
+
+  return x;
+}
+#endif
+
+#if defined(MIPMAP_AVX2)
+// Eight pixels per step, the same as SSE2 on each 128 bit lane.
+__attribute__((target("avx2"))) static unsigned
+BoxRowAVX2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+           unsigned count) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i two = _mm256_set1_epi16(2);
+  unsigned x = 0;
+  for (; x + 8 <= count; x += 8) {
+    __m256i halves[2];
+    for (int half = 0; half < 2; half++) {
+      __m256i a =
+          _mm256_loadu_si256((const __m256i *)(row0 + x * 8 + half * 32));
+      __m256i b =
+          _mm256_loadu_si256((const __m256i *)(row1 + x * 8 + half * 32));
+      __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+                                    _mm256_unpacklo_epi8(b, zero));
+      __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+                                    _mm256_unpackhi_epi8(b, zero));
+      __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi),
+                                     _mm256_unpackhi_epi64(lo, hi));
+      halves[half] = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+    }
+
+    // Packing works per lane, put the pixels back in order
+    __m256i packed = _mm256_packus_epi16(halves[0], halves[1]);
+    _mm256_storeu_si256((__m256i *)(dst + x * 4),
+                        _mm256_permute4x64_epi64(packed, 0xd8));
+  }
+
+  return x;
+}
+#endif
+
+#if defined(__ARM_NEON)
+// Eight pixels per step, channels are deinterleaved by the loads.
+static unsigned BoxRowNEON(const uint8_t *row0, const uint8_t *row1,
+                           uint8_t *dst, unsigned count) {
+  unsigned x = 0;
+  for (; x + 8 <= count; x += 8) {
+    uint8x16x4_t a = vld4q_u8(row0 + x * 8);
+    uint8x16x4_t b = vld4q_u8(row1 + x * 8);
+    uint8x8x4_t out;
+    for (int channel = 0; channel < 4; channel++) {
+      uint16x8_t sum = vpadalq_u8(vpaddlq_u8(a.val[channel]), b.val[channel]);
+      out.val[channel] = vrshrn_n_u16(sum, 2);
+    }
+    vst4_u8(dst + x * 4, out);
+  }
+
+  return x;
+}
+#endif
+
+static void InitMipmap() {
+  mipmap.boxRow = BoxRowNone;
+  mipmap.kernelName = "scalar";
+#if defined(__ARM_NEON)
+  mipmap.boxRow = BoxRowNEON;
+  mipmap.kernelName = "neon";
+#endif
+#if defined(__SSE2__)
+  mipmap.boxRow = BoxRowSSE2;
+  mipmap.kernelName = "sse2";
+#endif
+#if defined(MIPMAP_AVX2)
+  if (__builtin_cpu_supports("avx2")) {
+    mipmap.boxRow = BoxRowAVX2;
+    mipmap.kernelName = "avx2";
+  }
+#endif
+
+  for (int value = 0; value < 256; value++) {
+    double srgb = value / 255.0;
+    double linear = srgb <= 0.04045 ? srgb / 12.92
+                                    : pow((srgb + 0.055) / 1.055, 2.4);
+    mipmap.toLinear[value] = (uint16_t)lrint(linear * 65535.0);
+  }
+
+  // Each encoding starts halfway from the previous one
+  mipmap.thresholds[0] = 0;
+  for (int value = 1; value < 256; value++) {
+    double srgb = (value - 0.5) / 255.0;
+    double linear = srgb <= 0.04045 ? srgb / 12.92
+                                    : pow((srgb + 0.055) / 1.055, 2.4);
+    mipmap.thresholds[value] = (uint32_t)ceil(linear * 65535.0 * 4.0);
+  }
+  mipmap.thresholds[256] = UINT32_MAX;
+
+  unsigned value = 0;
+  for (unsigned bucket = 0; bucket < MIPMAP_ENCODE_SIZE; bucket++) {
+    uint32_t sum = bucket << MIPMAP_ENCODE_SHIFT;
+    while (sum >= mipmap.thresholds[value + 1]) {
+      value += 1;
+    }
+    mipmap.encode[bucket] = (uint8_t)value;
+  }
+}
+
+// sRGB byte closest to the average of four linear samples.
+static uint8_t EncodeSRGB(uint32_t sum) {
+  unsigned value = mipmap.encode[sum >> MIPMAP_ENCODE_SHIFT];
+  while (sum >= mipmap.thresholds[value + 1]) {
+    value += 1;
+  }
+
+  return (uint8_t)value;
+}
+
+// Average pixels from two rows, step is the distance in bytes between the
+// two columns of each pair, 0 when the source is one pixel wide.
+static void BoxRowScalar(const uint8_t *row0, const uint8_t *row1,
+                         uint8_t *dst, unsigned count, unsigned step,
+                         bool srgb) {
+  for (unsigned x = 0; x < count; x++) {
+    const uint8_t *a = row0 + x * 8;
+    const uint8_t *b = row1 + x * 8;
+    uint8_t *out = dst + x * 4;
+    for (int channel = 0; channel < 4; channel++) {
+      int i = channel;
+      int j = channel + step;
+      if (srgb && channel < 3) {
+        uint32_t sum = (uint32_t)mipmap.toLinear[a[i]] +
+                       mipmap.toLinear[a[j]] + mipmap.toLinear[b[i]] +
+                       mipmap.toLinear[b[j]];
+        out[channel] = EncodeSRGB(sum);
+      } else {
+        out[channel] = (uint8_t)((a[i] + a[j] + b[i] + b[j] + 2) >> 2);
+      }
+    }
+  }
+}
+
+static void DownsampleJob(void *arg) {
+  const MipmapBand *band = arg;
+  unsigned dstWidth = band->width > 1 ? band->width / 2 : 1;
+  unsigned step = band->width > 1 ? 4 : 0;
+  size_t srcPitch = (size_t)band->width * 4;
+  for (unsigned y = band->firstRow; y < band->lastRow; y++) {
+    unsigned y0 = band->height > 1 ? y * 2 : 0;
+    unsigned y1 = band->height > 1 ? y * 2 + 1 : 0;
+    const uint8_t *row0 = band->src + y0 * srcPitch;
+    const uint8_t *row1 = band->src + y1 * srcPitch;
+    uint8_t *dst = band->dst + (size_t)y * dstWidth * 4;
+
+    // sRGB colors need lookups, the vector kernels only do linear data
+    unsigned done = 0;
+    if (!band->srgb && step != 0) {
+      done = mipmap.boxRow(row0, row1, dst, dstWidth);
+    }
+
+    BoxRowScalar(row0 + done * 8, row1 + done * 8, dst + done * 4,
+                 dstWidth - done, step, band->srgb);
+  }
+}
+
+unsigned MipmapLevelCount(unsigned width, unsigned height) {
+  unsigned size = width > height ? width : height;
+  unsigned levels = 1;
+  while (size > 1) {
+    size /= 2;
+    levels += 1;
+  }
+
+  return levels;
+}
+
+void MipmapGenerate(unsigned char *data, const size_t *offsets,
+                    unsigned levels, unsigned imageCount, unsigned width,
+                    unsigned height, bool srgb) {
+  pthread_once(&mipmap.once, InitMipmap);
+  MipmapBand bands[MIPMAP_MAX_BANDS];
+  unsigned workers = (unsigned)JobsThreadCount() + 1;
+
+  // Levels depend on the previous one, rows and images run in parallel
+  for (unsigned level = 1; level < levels; level++) {
+    unsigned srcWidth = width >> (level - 1) ? width >> (level - 1) : 1;
+    unsigned srcHeight = height >> (level - 1) ? height >> (level - 1) : 1;
+    unsigned dstHeight = srcHeight > 1 ? srcHeight / 2 : 1;
+    unsigned rows = (dstHeight + workers - 1) / workers;
+    rows = rows < MIPMAP_BAND_ROWS ? MIPMAP_BAND_ROWS : rows;
+
+    JobGroup group = {0};
+    unsigned bandCount = 0;
+    for (unsigned image = 0; image < imageCount; image++) {
+      for (unsigned row = 0; row < dstHeight; row += rows) {
+        if (bandCount == MIPMAP_MAX_BANDS) {
+          JobsWait(&group);
+          bandCount = 0;
+        }
+
+        bands[bandCount] = (MipmapBand){
+            .src = data + offsets[(level - 1) * imageCount + image],
+            .width = srcWidth,
+            .height = srcHeight,
+            .dst = data + offsets[level * imageCount + image],
+            .firstRow = row,
+            .lastRow = row + rows < dstHeight ? row + rows : dstHeight,
+            .srgb = srgb,
+        };
+        JobsSubmit(DownsampleJob, &bands[bandCount], &group);
+        bandCount += 1;
+      }
+    }
+    JobsWait(&group);
+  }
+}
+
+const char *MipmapKernelName() {
+  pthread_once(&mipmap.once, InitMipmap);
+  return mipmap.kernelName;
+}
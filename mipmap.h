@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of levels of a full mip chain down to 1x1.
+unsigned MipmapLevelCount(unsigned width, unsigned height);
+
+// Fill levels 1 to levels - 1 of imageCount RGBA8 images from their base level
+// with a 2x2 box filter. The image of each level is at data + offsets[level *
+// imageCount + image]. sRGB colors are averaged in linear light. Rows of each
+// level are split among the worker pool.
+void MipmapGenerate(unsigned char *data, const size_t *offsets,
+                    unsigned levels, unsigned imageCount, unsigned width,
+                    unsigned height, bool srgb);
+
+// Name of the row kernel in use: avx2, sse2, neon or scalar.
+const char *MipmapKernelName();
@@ -0,0 +1,219 @@
+#include "asset.h"
+
+// Standard libraries
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  char *path;
+  uint64_t hash;
+  uint64_t size;
+} PackFile;
+
+typedef struct {
+  PackFile *files;
+  uint32_t count;
+  uint32_t capacity;
+} PackList;
+
+static void Usage(const char *program) {
+  fprintf(stderr, "usage: %s <bundle> <file or dir>...\n", program);
+}
+
+static bool AddFile(PackList *list, const char *path, uint64_t size) {
+  if (list->count == list->capacity) {
+    uint32_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+    PackFile *files = realloc(list->files, capacity * sizeof(PackFile));
+    if (files == NULL) {
+      return false;
+    }
+
+    list->files = files;
+    list->capacity = capacity;
+  }
+
+  // Keys are the paths the app is going to ask for
+  path = AssetBundlePath(path);
+  PackFile *file = &list->files[list->count];
+  file->path = strdup(path);
+  file->hash = AssetHash(ASSET_HASH_SEED, path, strlen(path));
+  file->size = size;
+  list->count += file->path != NULL;
+  return file->path != NULL;
+}
+
+// Add a file, or every file under a directory, hidden entries are skipped.
+static bool AddPath(PackList *list, const char *path) {
+  struct stat info = {0};
+  if (stat(path, &info) != 0) {
+    fprintf(stderr, "cannot stat %s\n", path);
+    return false;
+  }
+
+  if (S_ISREG(info.st_mode)) {
+    // Empty files cannot be mapped, leave them out as the loader would fail
+    return info.st_size == 0 || AddFile(list, path, (uint64_t)info.st_size);
+  }
+
+  if (!S_ISDIR(info.st_mode)) {
+    return true;
+  }
+
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+
+  bool ok = true;
+  struct dirent *entry = NULL;
+  while (ok && (entry = readdir(dir)) != NULL) {
+    char child[PATH_MAX];
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    int length = snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+    ok = length > 0 && (size_t)length < sizeof(child) && AddPath(list, child);
+  }
+
+  closedir(dir);
+  return ok;
+}
+
+static int CompareFiles(const void *a, const void *b) {
+  const PackFile *fileA = a;
+  const PackFile *fileB = b;
+  if (fileA->hash != fileB->hash) {
+    return fileA->hash < fileB->hash ? -1 : 1;
+  }
+
+  return strcmp(fileA->path, fileB->path);
+}
+
+static uint64_t AlignUp(uint64_t value) {
+  return (value + ASSET_BUNDLE_ALIGN - 1) & ~(uint64_t)(ASSET_BUNDLE_ALIGN - 1);
+}
+
+// Pad the file with zeros up to offset.
+static bool PadTo(FILE *file, uint64_t offset) {
+  static const unsigned char zeros[ASSET_BUNDLE_ALIGN] = {0};
+  long position = ftell(file);
+  if (position < 0 || (uint64_t)position > offset) {
+    return false;
+  }
+
+  uint64_t padding = offset - (uint64_t)position;
+  return fwrite(zeros, 1, padding, file) == padding;
+}
+
+static bool WriteBundle(const char *path, const PackList *list) {
+  AssetBundleHeader header = {
+      .magic = ASSET_BUNDLE_MAGIC,
+      .version = ASSET_BUNDLE_VERSION,
+      .entryCount = list->count,
+      .namesOffset = sizeof(AssetBundleHeader) +
+                     (uint64_t)list->count * sizeof(AssetBundleEntry),
+  };
+
+  AssetBundleEntry *entries = calloc(list->count, sizeof(AssetBundleEntry));
+  if (list->count > 0 && entries == NULL) {
+    return false;
+  }
+
+  // Lay out the names right after the index, then every aligned payload
+  for (uint32_t i = 0; i < list->count; i++) {
+    entries[i].hash = list->files[i].hash;
+    entries[i].size = list->files[i].size;
+    entries[i].nameOffset = (uint32_t)header.namesSize;
+    entries[i].nameSize = (uint32_t)strlen(list->files[i].path);
+    header.namesSize += entries[i].nameSize;
+  }
+
+  uint64_t offset = header.namesOffset + header.namesSize;
+  for (uint32_t i = 0; i < list->count; i++) {
+    entries[i].offset = AlignUp(offset);
+    offset = entries[i].offset + entries[i].size;
+  }
+
+  char tmpPath[PATH_MAX];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, getpid());
+  FILE *file = fopen(tmpPath, "we");
+  if (file == NULL) {
+    fprintf(stderr, "cannot create %s\n", tmpPath);
+    free(entries);
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(entries, sizeof(AssetBundleEntry), list->count, file) ==
+                list->count;
+  for (uint32_t i = 0; ok && i < list->count; i++) {
+    ok = fwrite(list->files[i].path, 1, entries[i].nameSize, file) ==
+         entries[i].nameSize;
+  }
+
+  for (uint32_t i = 0; ok && i < list->count; i++) {
+    Asset asset = {0};
+    if (!AssetOpen(list->files[i].path, ASSET_READ_SEQUENTIAL, &asset) ||
+        asset.size != entries[i].size) {
+      fprintf(stderr, "cannot read %s\n", list->files[i].path);
+      AssetClose(&asset);
+      ok = false;
+      break;
+    }
+
+    ok = PadTo(file, entries[i].offset) &&
+         fwrite(asset.data, 1, asset.size, file) == asset.size;
+    AssetClose(&asset);
+  }
+
+  // Readers never see a partially written bundle
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmpPath, path) != 0) {
+    fprintf(stderr, "cannot write %s\n", path);
+    unlink(tmpPath);
+    ok = false;
+  }
+
+  free(entries);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  PackList list = {0};
+  bool ok = true;
+  for (int i = 2; ok && i < argc; i++) {
+    ok = AddPath(&list, argv[i]);
+  }
+
+  // Sorted by hash so the loader can binary search the index
+  qsort(list.files, list.count, sizeof(PackFile), CompareFiles);
+  for (uint32_t i = 1; ok && i < list.count; i++) {
+    if (strcmp(list.files[i - 1].path, list.files[i].path) == 0) {
+      fprintf(stderr, "duplicated path %s\n", list.files[i].path);
+      ok = false;
+    }
+  }
+
+  ok = ok && WriteBundle(argv[1], &list);
+  if (ok) {
+    printf("packed %u files into %s\n", list.count, argv[1]);
+  }
+
+  for (uint32_t i = 0; i < list.count; i++) {
+    free(list.files[i].path);
+  }
+  free(list.files);
+  return ok ? 0 : 1;
+}
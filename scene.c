@@ -0,0 +1,514 @@
+#include "scene.h"
+#include "app.h"
+
+// Standard libraries
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define SCENE_DEFAULT_CELL_SIZE 4.0f
+#define SCENE_NO_ENTRY (~0u)
+
+// Frustum planes padded to eight with planes every box is inside, a point is
+// inside when a * x + b * y + c * z + d >= 0 for all of them.
+typedef struct {
+  float a[8];
+  float b[8];
+  float c[8];
+  float d[8];
+  float absA[8];
+  float absB[8];
+  float absC[8];
+} Frustum;
+
+typedef enum {
+  CULL_OUTSIDE,
+  CULL_INTERSECTS,
+  CULL_INSIDE,
+} CullResult;
+
+// Models are indexed by the cell their center is in. Cells grow by the
+// extents of their models, so a model never pokes out of its loose cell.
+typedef struct {
+  int key[3];
+  float loose[3];
+  unsigned *entries;
+  unsigned count;
+  unsigned capacity;
+} Cell;
+
+typedef struct {
+  // Hot data read by culling, one array per component
+  float *centerX;
+  float *centerY;
+  float *centerZ;
+  float *extentX;
+  float *extentY;
+  float *extentZ;
+  // Cold data read for visible models only
+  Mat4 *transforms;
+  Model *models;
+  unsigned *handles;
+  unsigned *cells;
+  unsigned *cellSlots;
+  unsigned count;
+  unsigned capacity;
+  // Entry of each handle, handle 0 is never given
+  unsigned *entries;
+  unsigned handleCount;
+  unsigned handleCapacity;
+  unsigned *freeHandles;
+  unsigned freeCount;
+  // Cells and an open addressing table of their index plus one by key
+  float cellSize;
+  Cell *cellList;
+  unsigned cellCount;
+  unsigned cellCapacity;
+  unsigned *cellTable;
+  unsigned tableSize;
+} Scene;
+
+static Scene scene = {0};
+
+// Grow an array to capacity items of size bytes, false if out of memory.
+static bool GrowArray(void **array, unsigned capacity, size_t size) {
+  void *grown = realloc(*array, capacity * size);
+  if (grown == NULL) {
+    return false;
+  }
+
+  *array = grown;
+  return true;
+}
+
+static bool ReserveEntries(unsigned count) {
+  if (count <= scene.capacity) {
+    return true;
+  }
+
+  unsigned capacity = scene.capacity == 0 ? 256 : scene.capacity * 2;
+  bool ok = GrowArray((void **)&scene.centerX, capacity, sizeof(float)) &&
+            GrowArray((void **)&scene.centerY, capacity, sizeof(float)) &&
+            GrowArray((void **)&scene.centerZ, capacity, sizeof(float)) &&
+            GrowArray((void **)&scene.extentX, capacity, sizeof(float)) &&
+            GrowArray((void **)&scene.extentY, capacity, sizeof(float)) &&
+            GrowArray((void **)&scene.extentZ, capacity, sizeof(float)) &&
+            GrowArray((void **)&scene.transforms, capacity, sizeof(Mat4)) &&
+            GrowArray((void **)&scene.models, capacity, sizeof(Model)) &&
+            GrowArray((void **)&scene.handles, capacity, sizeof(unsigned)) &&
+            GrowArray((void **)&scene.cells, capacity, sizeof(unsigned)) &&
+            GrowArray((void **)&scene.cellSlots, capacity, sizeof(unsigned));
+  if (ok) {
+    scene.capacity = capacity;
+  }
+
+  return ok;
+}
+
+// Take a free handle or make a new one, 0 if out of memory.
+static unsigned AllocHandle() {
+  if (scene.freeCount > 0) {
+    return scene.freeHandles[--scene.freeCount];
+  }
+
+  if (scene.handleCount + 1 >= scene.handleCapacity) {
+    unsigned capacity =
+        scene.handleCapacity == 0 ? 256 : scene.handleCapacity * 2;
+    if (!GrowArray((void **)&scene.entries, capacity, sizeof(unsigned)) ||
+        !GrowArray((void **)&scene.freeHandles, capacity, sizeof(unsigned))) {
+      return 0;
+    }
+    scene.handleCapacity = capacity;
+  }
+
+  return ++scene.handleCount;
+}
+
+static uint32_t HashCell(const int key[3]) {
+  uint32_t hash = (uint32_t)key[0] * 73856093u;
+  hash ^= (uint32_t)key[1] * 19349663u;
+  hash ^= (uint32_t)key[2] * 83492791u;
+  return hash;
+}
+
+// Slot of a key in the cell table, either holding it or empty.
+static unsigned FindCellSlot(const int key[3]) {
+  unsigned mask = scene.tableSize - 1;
+  unsigned slot = HashCell(key) & mask;
+  while (scene.cellTable[slot] != 0) {
+    const Cell *cell = &scene.cellList[scene.cellTable[slot] - 1];
+    if (memcmp(cell->key, key, sizeof(cell->key)) == 0) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return slot;
+}
+
+// Double the cell table and insert every cell again.
+static bool GrowCellTable() {
+  unsigned size = scene.tableSize == 0 ? 256 : scene.tableSize * 2;
+  unsigned *table = calloc(size, sizeof(unsigned));
+  if (table == NULL) {
+    return false;
+  }
+
+  free(scene.cellTable);
+  scene.cellTable = table;
+  scene.tableSize = size;
+  for (unsigned i = 0; i < scene.cellCount; i++) {
+    scene.cellTable[FindCellSlot(scene.cellList[i].key)] = i + 1;
+  }
+
+  return true;
+}
+
+// Find the cell holding a point or make it, SCENE_NO_ENTRY if out of memory.
+// Empty cells are kept so models moving back and forth reuse them.
+static unsigned AcquireCell(float x, float y, float z) {
+  int key[3] = {
+      (int)floorf(x / scene.cellSize),
+      (int)floorf(y / scene.cellSize),
+      (int)floorf(z / scene.cellSize),
+  };
+
+  if ((scene.cellCount + 1) * 2 > scene.tableSize && !GrowCellTable()) {
+    return SCENE_NO_ENTRY;
+  }
+
+  unsigned slot = FindCellSlot(key);
+  if (scene.cellTable[slot] != 0) {
+    return scene.cellTable[slot] - 1;
+  }
+
+  if (scene.cellCount == scene.cellCapacity) {
+    unsigned capacity = scene.cellCapacity == 0 ? 64 : scene.cellCapacity * 2;
+    if (!GrowArray((void **)&scene.cellList, capacity, sizeof(Cell))) {
+      return SCENE_NO_ENTRY;
+    }
+    scene.cellCapacity = capacity;
+  }
+
+  scene.cellList[scene.cellCount] = (Cell){.key = {key[0], key[1], key[2]}};
+  scene.cellTable[slot] = scene.cellCount + 1;
+  return scene.cellCount++;
+}
+
+// Grow a cell by the extents of an entry centered in it.
+static void LoosenCell(Cell *cell, unsigned entry) {
+  cell->loose[0] = fmaxf(cell->loose[0], scene.extentX[entry]);
+  cell->loose[1] = fmaxf(cell->loose[1], scene.extentY[entry]);
+  cell->loose[2] = fmaxf(cell->loose[2], scene.extentZ[entry]);
+}
+
+// Add an entry to a cell and grow the cell by its extents.
+static bool LinkEntry(unsigned cellIndex, unsigned entry) {
+  Cell *cell = &scene.cellList[cellIndex];
+  if (cell->count == cell->capacity) {
+    unsigned capacity = cell->capacity == 0 ? 8 : cell->capacity * 2;
+    if (!GrowArray((void **)&cell->entries, capacity, sizeof(unsigned))) {
+      return false;
+    }
+    cell->capacity = capacity;
+  }
+
+  LoosenCell(cell, entry);
+  cell->entries[cell->count] = entry;
+  scene.cells[entry] = cellIndex;
+  scene.cellSlots[entry] = cell->count++;
+  return true;
+}
+
+// Remove an entry from its cell, the loose extents stay as they were.
+static void UnlinkEntry(unsigned entry) {
+  Cell *cell = &scene.cellList[scene.cells[entry]];
+  unsigned slot = scene.cellSlots[entry];
+  unsigned last = cell->entries[--cell->count];
+  cell->entries[slot] = last;
+  scene.cellSlots[last] = slot;
+}
+
+// Bounds of a model in world space, the box around its transformed box.
+static void PlaceEntry(unsigned entry, Bounds bounds, Mat4 transform) {
+  float center[3] = {0};
+  float extent[3] = {0};
+  for (int row = 0; row < 3; row++) {
+    center[row] = transform.m[12 + row];
+    for (int k = 0; k < 3; k++) {
+      float value = transform.m[k * 4 + row];
+      float localCenter = 0.5f * (bounds.min[k] + bounds.max[k]);
+      float localExtent = 0.5f * (bounds.max[k] - bounds.min[k]);
+      center[row] += value * localCenter;
+      extent[row] += fabsf(value) * localExtent;
+    }
+  }
+
+  scene.centerX[entry] = center[0];
+  scene.centerY[entry] = center[1];
+  scene.centerZ[entry] = center[2];
+  scene.extentX[entry] = extent[0];
+  scene.extentY[entry] = extent[1];
+  scene.extentZ[entry] = extent[2];
+  scene.transforms[entry] = transform;
+}
+
+unsigned AppSceneAdd(Model model, Mat4 transform) {
+  assert(model.vao != 0 && "invalid arg model.vao: uninitialized vertex array");
+  if (scene.cellSize == 0.0f) {
+    scene.cellSize = SCENE_DEFAULT_CELL_SIZE;
+  }
+
+  unsigned handle = AllocHandle();
+  if (handle == 0 || !ReserveEntries(scene.count + 1)) {
+    if (handle != 0) {
+      scene.freeHandles[scene.freeCount++] = handle;
+    }
+    return 0;
+  }
+
+  unsigned entry = scene.count;
+  scene.models[entry] = model;
+  scene.handles[entry] = handle;
+  PlaceEntry(entry, model.bounds, transform);
+  unsigned cell = AcquireCell(scene.centerX[entry], scene.centerY[entry],
+                              scene.centerZ[entry]);
+  if (cell == SCENE_NO_ENTRY || !LinkEntry(cell, entry)) {
+    scene.freeHandles[scene.freeCount++] = handle;
+    return 0;
+  }
+
+  scene.entries[handle] = entry;
+  scene.count += 1;
+  return handle;
+}
+
+void AppSceneMove(unsigned handle, Mat4 transform) {
+  assert(handle != 0 && handle <= scene.handleCount &&
+         "invalid arg handle: not in the scene");
+  unsigned entry = scene.entries[handle];
+  assert(entry != SCENE_NO_ENTRY && "invalid arg handle: already removed");
+  PlaceEntry(entry, scene.models[entry].bounds, transform);
+
+  // Only models that leave their cell touch the grid
+  unsigned cell = AcquireCell(scene.centerX[entry], scene.centerY[entry],
+                              scene.centerZ[entry]);
+  if (cell == scene.cells[entry]) {
+    LoosenCell(&scene.cellList[cell], entry);
+    return;
+  }
+
+  unsigned previous = scene.cells[entry];
+  UnlinkEntry(entry);
+  if (cell != SCENE_NO_ENTRY && LinkEntry(cell, entry)) {
+    return;
+  }
+
+  // Out of memory, stay in the old cell and grow it to still cover the model
+  LinkEntry(previous, entry);
+  Cell *current = &scene.cellList[previous];
+  float center[3] = {scene.centerX[entry], scene.centerY[entry],
+                     scene.centerZ[entry]};
+  for (int axis = 0; axis < 3; axis++) {
+    float cellCenter = (current->key[axis] + 0.5f) * scene.cellSize;
+    current->loose[axis] += fabsf(center[axis] - cellCenter);
+  }
+}
+
+void AppSceneRemove(unsigned handle) {
+  assert(handle != 0 && handle <= scene.handleCount &&
+         "invalid arg handle: not in the scene");
+  unsigned entry = scene.entries[handle];
+  assert(entry != SCENE_NO_ENTRY && "invalid arg handle: already removed");
+  UnlinkEntry(entry);
+
+  // Fill the hole with the last entry so arrays stay dense
+  unsigned last = --scene.count;
+  if (entry != last) {
+    scene.centerX[entry] = scene.centerX[last];
+    scene.centerY[entry] = scene.centerY[last];
+    scene.centerZ[entry] = scene.centerZ[last];
+    scene.extentX[entry] = scene.extentX[last];
+    scene.extentY[entry] = scene.extentY[last];
+    scene.extentZ[entry] = scene.extentZ[last];
+    scene.transforms[entry] = scene.transforms[last];
+    scene.models[entry] = scene.models[last];
+    scene.handles[entry] = scene.handles[last];
+    scene.cells[entry] = scene.cells[last];
+    scene.cellSlots[entry] = scene.cellSlots[last];
+    scene.cellList[scene.cells[entry]].entries[scene.cellSlots[entry]] = entry;
+    scene.entries[scene.handles[entry]] = entry;
+  }
+
+  scene.entries[handle] = SCENE_NO_ENTRY;
+  scene.freeHandles[scene.freeCount++] = handle;
+}
+
+void AppSetSceneCellSize(float size) {
+  assert(size > 0.0f && "invalid arg size: must be positive");
+  assert(scene.count == 0 && "invalid state: scene is not empty");
+  scene.cellSize = size;
+  for (unsigned i = 0; i < scene.cellCount; i++) {
+    free(scene.cellList[i].entries);
+  }
+  scene.cellCount = 0;
+  if (scene.cellTable != NULL) {
+    memset(scene.cellTable, 0, scene.tableSize * sizeof(unsigned));
+  }
+}
+
+// Planes of the clip volume -w <= x, y, z <= w in world space.
+static Frustum MakeFrustum(Mat4 viewProj) {
+  Frustum frustum = {0};
+  const float *m = viewProj.m;
+  for (int i = 0; i < 6; i++) {
+    int axis = i / 2;
+    float sign = i % 2 == 0 ? 1.0f : -1.0f;
+    frustum.a[i] = m[3] + sign * m[axis];
+    frustum.b[i] = m[7] + sign * m[4 + axis];
+    frustum.c[i] = m[11] + sign * m[8 + axis];
+    frustum.d[i] = m[15] + sign * m[12 + axis];
+  }
+
+  frustum.d[6] = 1.0f;
+  frustum.d[7] = 1.0f;
+  for (int i = 0; i < 8; i++) {
+    frustum.absA[i] = fabsf(frustum.a[i]);
+    frustum.absB[i] = fabsf(frustum.b[i]);
+    frustum.absC[i] = fabsf(frustum.c[i]);
+  }
+
+  return frustum;
+}
+
+// Test a box against every plane at once, a box is outside if its nearest
+// corner is behind a plane and inside if its farthest corner is in front of
+// all of them.
+static CullResult CullBox(const Frustum *frustum, float x, float y, float z,
+                          float ex, float ey, float ez) {
+#if defined(__SSE2__)
+  __m128 zero = _mm_setzero_ps();
+  int outside = 0;
+  int inside = 0;
+  for (int i = 0; i < 8; i += 4) {
+    __m128 dist = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(frustum->a + i), _mm_set1_ps(x)),
+                   _mm_mul_ps(_mm_loadu_ps(frustum->b + i), _mm_set1_ps(y))),
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(frustum->c + i), _mm_set1_ps(z)),
+                   _mm_loadu_ps(frustum->d + i)));
+    __m128 radius = _mm_add_ps(
+        _mm_add_ps(
+            _mm_mul_ps(_mm_loadu_ps(frustum->absA + i), _mm_set1_ps(ex)),
+            _mm_mul_ps(_mm_loadu_ps(frustum->absB + i), _mm_set1_ps(ey))),
+        _mm_mul_ps(_mm_loadu_ps(frustum->absC + i), _mm_set1_ps(ez)));
+    outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), zero));
+    inside |= _mm_movemask_ps(_mm_cmpge_ps(_mm_sub_ps(dist, radius), zero))
+              << i;
+  }
+  if (outside != 0) {
+    return CULL_OUTSIDE;
+  }
+  return inside == 0xff ? CULL_INSIDE : CULL_INTERSECTS;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  uint32_t outside = 0;
+  uint32_t inside = UINT32_MAX;
+  for (int i = 0; i < 8; i += 4) {
+    float32x4_t dist = vld1q_f32(frustum->d + i);
+    dist = vmlaq_n_f32(dist, vld1q_f32(frustum->a + i), x);
+    dist = vmlaq_n_f32(dist, vld1q_f32(frustum->b + i), y);
+    dist = vmlaq_n_f32(dist, vld1q_f32(frustum->c + i), z);
+    float32x4_t radius = vmulq_n_f32(vld1q_f32(frustum->absA + i), ex);
+    radius = vmlaq_n_f32(radius, vld1q_f32(frustum->absB + i), ey);
+    radius = vmlaq_n_f32(radius, vld1q_f32(frustum->absC + i), ez);
+    outside |= vmaxvq_u32(vcltq_f32(vaddq_f32(dist, radius), zero));
+    inside &= vminvq_u32(vcgeq_f32(vsubq_f32(dist, radius), zero));
+  }
+  if (outside != 0) {
+    return CULL_OUTSIDE;
+  }
+  return inside != 0 ? CULL_INSIDE : CULL_INTERSECTS;
+#else
+  bool inside = true;
+  for (int i = 0; i < 6; i++) {
+    float dist = frustum->a[i] * x + frustum->b[i] * y + frustum->c[i] * z +
+                 frustum->d[i];
+    float radius = frustum->absA[i] * ex + frustum->absB[i] * ey +
+                   frustum->absC[i] * ez;
+    if (dist + radius < 0.0f) {
+      return CULL_OUTSIDE;
+    }
+    inside = inside && dist - radius >= 0.0f;
+  }
+  return inside ? CULL_INSIDE : CULL_INTERSECTS;
+#endif
+}
+
+unsigned AppSubmitScene(Mat4 viewProj) {
+  AppTimerBegin("cull");
+  Frustum frustum = MakeFrustum(viewProj);
+  float half = 0.5f * scene.cellSize;
+  unsigned submitted = 0;
+  for (unsigned i = 0; i < scene.cellCount; i++) {
+    const Cell *cell = &scene.cellList[i];
+    if (cell->count == 0) {
+      continue;
+    }
+
+    // Cells wholly inside or outside decide for all their models
+    CullResult result = CullBox(
+        &frustum, (cell->key[0] + 0.5f) * scene.cellSize,
+        (cell->key[1] + 0.5f) * scene.cellSize,
+        (cell->key[2] + 0.5f) * scene.cellSize, half + cell->loose[0],
+        half + cell->loose[1], half + cell->loose[2]);
+    if (result == CULL_OUTSIDE) {
+      continue;
+    }
+
+    for (unsigned j = 0; j < cell->count; j++) {
+      unsigned entry = cell->entries[j];
+      if (result == CULL_INSIDE ||
+          CullBox(&frustum, scene.centerX[entry], scene.centerY[entry],
+                  scene.centerZ[entry], scene.extentX[entry],
+                  scene.extentY[entry],
+                  scene.extentZ[entry]) != CULL_OUTSIDE) {
+        AppSubmit(scene.models[entry], scene.transforms[entry]);
+        submitted += 1;
+      }
+    }
+  }
+  AppTimerEnd();
+
+  AppSetViewProjection(viewProj);
+  return submitted;
+}
+
+void SceneShutdown() {
+  free(scene.centerX);
+  free(scene.centerY);
+  free(scene.centerZ);
+  free(scene.extentX);
+  free(scene.extentY);
+  free(scene.extentZ);
+  free(scene.transforms);
+  free(scene.models);
+  free(scene.handles);
+  free(scene.cells);
+  free(scene.cellSlots);
+  free(scene.entries);
+  free(scene.freeHandles);
+  for (unsigned i = 0; i < scene.cellCount; i++) {
+    free(scene.cellList[i].entries);
+  }
+  free(scene.cellList);
+  free(scene.cellTable);
+  scene = (Scene){0};
+}
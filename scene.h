@@ -0,0 +1,4 @@
+#pragma once
+
+// Free the models list and the grid, used by AppClose.
+void SceneShutdown();
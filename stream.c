@@ -0,0 +1,311 @@
+#include "stream.h"
+#include "app.h"
+#include "memstats.h"
+
+// Standard libraries
+#include <assert.h>
+#include <stdlib.h>
+
+// GLAD
+#include <glad/glad.h>
+
+// Frames in flight, each writes its own segment of the ring.
+#define STREAM_FRAMES 3
+#define STREAM_DEFAULT_SIZE (4 << 20)
+#define STREAM_WAIT_NANOS 1000000000ull
+
+// A buffer replaced while spans in it were still in flight, staging and the
+// range not flushed yet are kept for spans written after the replacement.
+typedef struct {
+  unsigned buffer;
+  GLsync fence;
+  unsigned char *staging;
+  size_t flushed;
+  size_t head;
+} RetiredBuffer;
+
+typedef struct {
+  unsigned buffer;
+  // Persistent mapping, or staging memory flushed with glBufferSubData when
+  // the driver lacks GL_ARB_buffer_storage
+  unsigned char *mapping;
+  bool persistent;
+  size_t segmentSize;
+  size_t requestedSize;
+  GLsync fences[STREAM_FRAMES];
+  unsigned segment;
+  size_t head;
+  size_t flushed;
+  bool waited;
+  size_t uniformAlignment;
+  RetiredBuffer *retired;
+  unsigned retiredCount;
+  unsigned retiredCapacity;
+} Stream;
+
+static Stream stream = {
+    .requestedSize = STREAM_DEFAULT_SIZE,
+};
+
+static void WaitFence(GLsync fence) {
+  GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  while (true) {
+    GLenum result = glClientWaitSync(fence, flags, STREAM_WAIT_NANOS);
+    if (result != GL_TIMEOUT_EXPIRED) {
+      return;
+    }
+
+    flags = 0;
+  }
+}
+
+static void FreeFences() {
+  for (int i = 0; i < STREAM_FRAMES; i++) {
+    if (stream.fences[i] != NULL) {
+      glDeleteSync(stream.fences[i]);
+      stream.fences[i] = NULL;
+    }
+  }
+}
+
+static bool CreateBuffer(size_t segmentSize) {
+  size_t size = segmentSize * STREAM_FRAMES;
+  glGenBuffers(1, &stream.buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+  if (GLAD_GL_ARB_buffer_storage) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr)size, NULL, flags);
+    stream.mapping =
+        glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)size, flags);
+    stream.persistent = true;
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+    stream.mapping = malloc(size);
+    stream.persistent = false;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if (stream.mapping == NULL) {
+    glDeleteBuffers(1, &stream.buffer);
+    stream.buffer = 0;
+    return false;
+  }
+
+  stream.segmentSize = segmentSize;
+  MemoryTrack(MEMORY_GPU_BUFFER, stream.buffer, size, 0, 0, "stream ring");
+  return true;
+}
+
+// Unmap a buffer and delete it, the GPU must be done with it.
+static void DeleteBuffer(unsigned buffer, unsigned char *staging) {
+  MemoryUntrack(MEMORY_GPU_BUFFER, buffer);
+  glDeleteBuffers(1, &buffer);
+  free(staging);
+}
+
+// Copy staging memory between two buffer offsets to the buffer.
+static void FlushRange(unsigned buffer, const unsigned char *staging,
+                       size_t from, size_t to) {
+  if (from >= to) {
+    return;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)from,
+                  (GLsizeiptr)(to - from), staging + from);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Keep the current buffer alive until the spans of this frame are drawn and
+// make a larger one, the next spans of this frame go to its first segment.
+static bool GrowBuffer(size_t needed) {
+  size_t segmentSize = stream.segmentSize;
+  while (segmentSize < needed) {
+    segmentSize *= 2;
+  }
+
+  if (stream.buffer != 0) {
+    if (stream.retiredCount == stream.retiredCapacity) {
+      unsigned capacity =
+          stream.retiredCapacity == 0 ? 4 : stream.retiredCapacity * 2;
+      RetiredBuffer *retired =
+          realloc(stream.retired, capacity * sizeof(RetiredBuffer));
+      if (retired == NULL) {
+        return false;
+      }
+
+      stream.retired = retired;
+      stream.retiredCapacity = capacity;
+    }
+
+    // Fences of the old buffer are superseded by the one of this frame
+    size_t base = stream.segment * stream.segmentSize;
+    stream.retired[stream.retiredCount++] = (RetiredBuffer){
+        .buffer = stream.buffer,
+        .staging = stream.persistent ? NULL : stream.mapping,
+        .flushed = base + stream.flushed,
+        .head = base + stream.head,
+    };
+
+    stream.buffer = 0;
+    stream.mapping = NULL;
+    FreeFences();
+  }
+
+  stream.segment = 0;
+  stream.head = 0;
+  stream.flushed = 0;
+  stream.waited = true;
+  return CreateBuffer(segmentSize);
+}
+
+static size_t UsageAlignment(StreamUsage usage) {
+  switch (usage) {
+  case STREAM_INDEX:
+    return sizeof(unsigned);
+  case STREAM_UNIFORM:
+    if (stream.uniformAlignment == 0) {
+      GLint alignment = 0;
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+      stream.uniformAlignment = alignment > 16 ? (size_t)alignment : 16;
+    }
+    return stream.uniformAlignment;
+  case STREAM_VERTEX:
+  default:
+    return 16;
+  }
+}
+
+StreamSpan AppStreamAlloc(StreamUsage usage, size_t size) {
+  assert(size > 0 && "invalid arg size: cannot be zero");
+  if (stream.buffer == 0) {
+    stream.segmentSize = stream.requestedSize;
+    if (!GrowBuffer(size)) {
+      return (StreamSpan){0};
+    }
+  }
+
+  // The first span of a frame waits until the GPU released the segment
+  if (!stream.waited) {
+    GLsync fence = stream.fences[stream.segment];
+    if (fence != NULL) {
+      WaitFence(fence);
+      glDeleteSync(fence);
+      stream.fences[stream.segment] = NULL;
+    }
+
+    stream.waited = true;
+  }
+
+  size_t alignment = UsageAlignment(usage);
+  size_t start = (stream.head + alignment - 1) / alignment * alignment;
+  if (start + size > stream.segmentSize) {
+    if (!GrowBuffer(start + size)) {
+      return (StreamSpan){0};
+    }
+
+    start = 0;
+  }
+
+  // Padding was never written, flush from where the span starts
+  if (stream.flushed == stream.head) {
+    stream.flushed = start;
+  }
+
+  stream.head = start + size;
+  size_t offset = stream.segment * stream.segmentSize + start;
+  return (StreamSpan){
+      .data = stream.mapping + offset,
+      .buffer = stream.buffer,
+      .offset = offset,
+      .size = size,
+  };
+}
+
+void AppStreamFlush() {
+  if (stream.persistent || stream.buffer == 0) {
+    return;
+  }
+
+  for (unsigned i = 0; i < stream.retiredCount; i++) {
+    RetiredBuffer *retired = &stream.retired[i];
+    if (retired->fence == NULL) {
+      FlushRange(retired->buffer, retired->staging, retired->flushed,
+                 retired->head);
+      retired->flushed = retired->head;
+    }
+  }
+
+  size_t base = stream.segment * stream.segmentSize;
+  FlushRange(stream.buffer, stream.mapping, base + stream.flushed,
+             base + stream.head);
+  stream.flushed = stream.head;
+}
+
+void AppSetStreamBufferSize(size_t bytesPerFrame) {
+  assert(bytesPerFrame > 0 && "invalid arg bytesPerFrame: cannot be zero");
+  stream.requestedSize = bytesPerFrame;
+}
+
+void StreamEndFrame() {
+  if (stream.buffer == 0) {
+    return;
+  }
+
+  // Retired buffers are deleted once the frames that used them are drawn
+  AppStreamFlush();
+  unsigned kept = 0;
+  for (unsigned i = 0; i < stream.retiredCount; i++) {
+    RetiredBuffer *retired = &stream.retired[i];
+    if (retired->fence == NULL) {
+      retired->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    } else if (glClientWaitSync(retired->fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+      glDeleteSync(retired->fence);
+      DeleteBuffer(retired->buffer, retired->staging);
+      continue;
+    }
+
+    stream.retired[kept++] = *retired;
+  }
+  stream.retiredCount = kept;
+
+  // Segments nothing was written to need no fence
+  if (stream.head > 0) {
+    stream.fences[stream.segment] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream.segment = (stream.segment + 1) % STREAM_FRAMES;
+    stream.waited = false;
+  }
+
+  stream.head = 0;
+  stream.flushed = 0;
+}
+
+void StreamShutdown() {
+  for (unsigned i = 0; i < stream.retiredCount; i++) {
+    RetiredBuffer *retired = &stream.retired[i];
+    if (retired->fence != NULL) {
+      WaitFence(retired->fence);
+      glDeleteSync(retired->fence);
+    }
+
+    DeleteBuffer(retired->buffer, retired->staging);
+  }
+
+  for (int i = 0; i < STREAM_FRAMES; i++) {
+    if (stream.fences[i] != NULL) {
+      WaitFence(stream.fences[i]);
+    }
+  }
+
+  FreeFences();
+  if (stream.buffer != 0) {
+    DeleteBuffer(stream.buffer, stream.persistent ? NULL : stream.mapping);
+  }
+
+  free(stream.retired);
+  stream = (Stream){
+      .requestedSize = STREAM_DEFAULT_SIZE,
+  };
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Fence the spans written this frame so their segment is reused only after
+// the GPU is done with it, used by AppEndFrame.
+void StreamEndFrame();
+
+// Wait for the GPU, then free the ring buffer, used by AppClose.
+void StreamShutdown();
@@ -0,0 +1,386 @@
+#include "telemetry.h"
+#include "app.h"
+
+// Standard libraries
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// GLAD
+#include <glad/glad.h>
+
+#define FRAME_SAMPLES 1024
+#define TIMER_SAMPLES 256
+#define MAX_TIMERS 32
+#define MAX_TIMER_NAME 32
+#define MAX_TIMER_DEPTH 16
+
+// Results are read a few frames late so the CPU never waits for the GPU.
+#define QUERY_COUNT 4
+
+typedef struct {
+  unsigned long frame;
+  float interval;
+  float cpu;
+  float gpu;
+  float latency;
+} FrameSample;
+
+typedef struct {
+  char name[MAX_TIMER_NAME];
+  int count;
+  float samples[TIMER_SAMPLES];
+} Timer;
+
+typedef struct {
+  int timer;
+  double start;
+} TimerScope;
+
+typedef struct {
+  unsigned long frame;
+  double frameStart;
+  double lastFrameStart;
+  FrameSample frames[FRAME_SAMPLES];
+  bool hasQueries;
+  unsigned queries[QUERY_COUNT];
+  unsigned long queryFrames[QUERY_COUNT];
+  bool queryPending[QUERY_COUNT];
+  pthread_mutex_t timerLock;
+  Timer timers[MAX_TIMERS];
+  int timerCount;
+  char *exportPath;
+} Telemetry;
+
+static Telemetry telemetry = {
+    .timerLock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Each thread keeps its own stack of running timers.
+static _Thread_local TimerScope scopes[MAX_TIMER_DEPTH];
+static _Thread_local int scopeDepth = 0;
+
+// Monotonic time in milliseconds.
+static double Now() {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+double TelemetryNow() { return Now(); }
+
+static int CompareFloats(const void *a, const void *b) {
+  float lhs = *(const float *)a;
+  float rhs = *(const float *)b;
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+// Compute percentiles by nearest rank, values are sorted in place.
+static TimingStats ComputeStats(float *values, int count) {
+  TimingStats stats = {.count = count};
+  if (count == 0) {
+    return stats;
+  }
+
+  qsort(values, count, sizeof(float), CompareFloats);
+  stats.p50 = values[(count - 1) * 50 / 100];
+  stats.p95 = values[(count - 1) * 95 / 100];
+  stats.p99 = values[(count - 1) * 99 / 100];
+  stats.worst = values[count - 1];
+  return stats;
+}
+
+// Store the results of finished queries without waiting for pending ones.
+static void CollectQueries() {
+  for (int i = 0; i < QUERY_COUNT; i++) {
+    if (!telemetry.queryPending[i]) {
+      continue;
+    }
+
+    int available = 0;
+    glGetQueryObjectiv(telemetry.queries[i], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available) {
+      continue;
+    }
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(telemetry.queries[i], GL_QUERY_RESULT, &elapsed);
+    telemetry.queryPending[i] = false;
+
+    unsigned long frame = telemetry.queryFrames[i];
+    FrameSample *sample = &telemetry.frames[frame % FRAME_SAMPLES];
+    if (sample->frame == frame) {
+      sample->gpu = (float)((double)elapsed / 1000000.0);
+    }
+  }
+}
+
+void TelemetryBeginFrame() {
+  if (telemetry.frame == 0) {
+    telemetry.hasQueries = GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query;
+    if (telemetry.hasQueries) {
+      glGenQueries(QUERY_COUNT, telemetry.queries);
+    }
+  }
+
+  telemetry.frame += 1;
+  telemetry.lastFrameStart = telemetry.frameStart;
+  telemetry.frameStart = Now();
+
+  FrameSample *sample = &telemetry.frames[telemetry.frame % FRAME_SAMPLES];
+  *sample =
+      (FrameSample){.frame = telemetry.frame, .gpu = -1.0f, .latency = -1.0f};
+  if (telemetry.lastFrameStart > 0.0) {
+    sample->interval =
+        (float)(telemetry.frameStart - telemetry.lastFrameStart);
+  }
+
+  if (!telemetry.hasQueries) {
+    return;
+  }
+
+  // Skip the GPU timing of this frame if its query is still in flight
+  CollectQueries();
+  int query = (int)(telemetry.frame % QUERY_COUNT);
+  if (!telemetry.queryPending[query]) {
+    glBeginQuery(GL_TIME_ELAPSED, telemetry.queries[query]);
+    telemetry.queryFrames[query] = telemetry.frame;
+    telemetry.queryPending[query] = true;
+  }
+}
+
+void TelemetryEndFrame() {
+  FrameSample *sample = &telemetry.frames[telemetry.frame % FRAME_SAMPLES];
+  sample->cpu = (float)(Now() - telemetry.frameStart);
+
+  int query = (int)(telemetry.frame % QUERY_COUNT);
+  if (telemetry.hasQueries && telemetry.queryPending[query] &&
+      telemetry.queryFrames[query] == telemetry.frame) {
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+}
+
+void TelemetryRecordLatency(double inputTime) {
+  FrameSample *sample = &telemetry.frames[telemetry.frame % FRAME_SAMPLES];
+  sample->latency = (float)(Now() - inputTime);
+}
+
+FrameStats AppGetFrameStats() {
+  static float intervals[FRAME_SAMPLES];
+  static float cpus[FRAME_SAMPLES];
+  static float gpus[FRAME_SAMPLES];
+  static float latencies[FRAME_SAMPLES];
+  int intervalCount = 0;
+  int cpuCount = 0;
+  int gpuCount = 0;
+  int latencyCount = 0;
+
+  // The current frame is not finished yet
+  for (int i = 0; i < FRAME_SAMPLES; i++) {
+    FrameSample *sample = &telemetry.frames[i];
+    if (sample->frame == 0 || sample->frame == telemetry.frame) {
+      continue;
+    }
+
+    if (sample->interval > 0.0f) {
+      intervals[intervalCount++] = sample->interval;
+    }
+
+    cpus[cpuCount++] = sample->cpu;
+    if (sample->gpu >= 0.0f) {
+      gpus[gpuCount++] = sample->gpu;
+    }
+
+    if (sample->latency >= 0.0f) {
+      latencies[latencyCount++] = sample->latency;
+    }
+  }
+
+  FrameStats stats = {0};
+  stats.interval = ComputeStats(intervals, intervalCount);
+  stats.cpu = ComputeStats(cpus, cpuCount);
+  stats.gpu = ComputeStats(gpus, gpuCount);
+  stats.latency = ComputeStats(latencies, latencyCount);
+  return stats;
+}
+
+// Find a timer by name, adding it if create is set. timerLock must be held.
+static int FindTimer(const char *name, bool create) {
+  for (int i = 0; i < telemetry.timerCount; i++) {
+    if (strncmp(telemetry.timers[i].name, name, MAX_TIMER_NAME - 1) == 0) {
+      return i;
+    }
+  }
+
+  if (!create || telemetry.timerCount == MAX_TIMERS) {
+    return -1;
+  }
+
+  Timer *timer = &telemetry.timers[telemetry.timerCount];
+  snprintf(timer->name, MAX_TIMER_NAME, "%s", name);
+  timer->count = 0;
+  return telemetry.timerCount++;
+}
+
+TimingStats AppGetTimerStats(const char *name) {
+  assert(name != NULL && "invalid arg name: cannot be NULL");
+  float samples[TIMER_SAMPLES];
+  int count = 0;
+
+  pthread_mutex_lock(&telemetry.timerLock);
+  int index = FindTimer(name, false);
+  if (index >= 0) {
+    Timer *timer = &telemetry.timers[index];
+    count = timer->count < TIMER_SAMPLES ? timer->count : TIMER_SAMPLES;
+    memcpy(samples, timer->samples, count * sizeof(float));
+  }
+  pthread_mutex_unlock(&telemetry.timerLock);
+
+  return ComputeStats(samples, count);
+}
+
+void AppTimerBegin(const char *name) {
+  assert(name != NULL && "invalid arg name: cannot be NULL");
+  assert(scopeDepth < MAX_TIMER_DEPTH && "invalid state: timers too nested");
+  if (scopeDepth == MAX_TIMER_DEPTH) {
+    return;
+  }
+
+  pthread_mutex_lock(&telemetry.timerLock);
+  int index = FindTimer(name, true);
+  pthread_mutex_unlock(&telemetry.timerLock);
+
+  scopes[scopeDepth++] = (TimerScope){.timer = index, .start = Now()};
+}
+
+void AppTimerEnd() {
+  assert(scopeDepth > 0 && "invalid state: no timer was started");
+  if (scopeDepth == 0) {
+    return;
+  }
+
+  TimerScope scope = scopes[--scopeDepth];
+  float elapsed = (float)(Now() - scope.start);
+  if (scope.timer < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&telemetry.timerLock);
+  Timer *timer = &telemetry.timers[scope.timer];
+  timer->samples[timer->count % TIMER_SAMPLES] = elapsed;
+  timer->count += 1;
+  pthread_mutex_unlock(&telemetry.timerLock);
+}
+
+static void WriteStatsCSV(FILE *file, const char *metric, TimingStats stats) {
+  fprintf(file, "%s,%d,%.4f,%.4f,%.4f,%.4f\n", metric, stats.count, stats.p50,
+          stats.p95, stats.p99, stats.worst);
+}
+
+static void WriteStatsJSON(FILE *file, const char *metric, TimingStats stats,
+                           bool last) {
+  fprintf(file,
+          "    \"%s\": {\"count\": %d, \"p50\": %.4f, \"p95\": %.4f, "
+          "\"p99\": %.4f, \"worst\": %.4f}%s\n",
+          metric, stats.count, stats.p50, stats.p95, stats.p99, stats.worst,
+          last ? "" : ",");
+}
+
+bool AppExportTelemetry(const char *path) {
+  assert(path != NULL && "invalid arg path: cannot be NULL");
+  FILE *file = fopen(path, "we");
+  if (file == NULL) {
+    return false;
+  }
+
+  FrameStats frame = AppGetFrameStats();
+  TimingStats timers[MAX_TIMERS];
+  char names[MAX_TIMERS][MAX_TIMER_NAME];
+  pthread_mutex_lock(&telemetry.timerLock);
+  int timerCount = telemetry.timerCount;
+  for (int i = 0; i < timerCount; i++) {
+    memcpy(names[i], telemetry.timers[i].name, MAX_TIMER_NAME);
+  }
+  pthread_mutex_unlock(&telemetry.timerLock);
+  for (int i = 0; i < timerCount; i++) {
+    timers[i] = AppGetTimerStats(names[i]);
+  }
+
+  size_t length = strlen(path);
+  bool json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+  if (!json) {
+    fprintf(file, "metric,count,p50_ms,p95_ms,p99_ms,worst_ms\n");
+    WriteStatsCSV(file, "frame_interval", frame.interval);
+    WriteStatsCSV(file, "frame_cpu", frame.cpu);
+    WriteStatsCSV(file, "frame_gpu", frame.gpu);
+    WriteStatsCSV(file, "frame_latency", frame.latency);
+    for (int i = 0; i < timerCount; i++) {
+      char metric[MAX_TIMER_NAME + 8];
+      snprintf(metric, sizeof(metric), "timer_%s", names[i]);
+      WriteStatsCSV(file, metric, timers[i]);
+    }
+    return fclose(file) == 0;
+  }
+
+  fprintf(file, "{\n  \"frames\": {\n");
+  WriteStatsJSON(file, "interval", frame.interval, false);
+  WriteStatsJSON(file, "cpu", frame.cpu, false);
+  WriteStatsJSON(file, "gpu", frame.gpu, false);
+  WriteStatsJSON(file, "latency", frame.latency, true);
+  fprintf(file, "  },\n  \"timers\": {\n");
+  for (int i = 0; i < timerCount; i++) {
+    WriteStatsJSON(file, names[i], timers[i], i == timerCount - 1);
+  }
+  fprintf(file, "  },\n  \"samples\": [\n");
+
+  // Oldest first, unknown GPU times and latencies are written as null
+  bool first = true;
+  for (int i = 1; i <= FRAME_SAMPLES; i++) {
+    FrameSample *sample =
+        &telemetry.frames[(telemetry.frame + i) % FRAME_SAMPLES];
+    if (sample->frame == 0 || sample->frame == telemetry.frame) {
+      continue;
+    }
+
+    fprintf(file, "%s    {\"frame\": %lu, \"interval\": %.4f, \"cpu\": %.4f, ",
+            first ? "" : ",\n", sample->frame, sample->interval, sample->cpu);
+    if (sample->gpu >= 0.0f) {
+      fprintf(file, "\"gpu\": %.4f, ", sample->gpu);
+    } else {
+      fprintf(file, "\"gpu\": null, ");
+    }
+
+    if (sample->latency >= 0.0f) {
+      fprintf(file, "\"latency\": %.4f}", sample->latency);
+    } else {
+      fprintf(file, "\"latency\": null}");
+    }
+    first = false;
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+void AppSetTelemetryExportPath(const char *path) {
+  free(telemetry.exportPath);
+  telemetry.exportPath = path != NULL ? strdup(path) : NULL;
+}
+
+void TelemetryShutdown() {
+  if (telemetry.exportPath != NULL) {
+    if (!AppExportTelemetry(telemetry.exportPath)) {
+      fprintf(stderr, "cannot export telemetry to %s\n", telemetry.exportPath);
+    }
+    free(telemetry.exportPath);
+    telemetry.exportPath = NULL;
+  }
+
+  if (telemetry.hasQueries) {
+    glDeleteQueries(QUERY_COUNT, telemetry.queries);
+    telemetry.hasQueries = false;
+  }
+}
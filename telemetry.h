@@ -0,0 +1,17 @@
+#pragma once
+
+// Start timing a frame, used by AppBeginFrame.
+void TelemetryBeginFrame();
+
+// Stop timing a frame before buffers are swapped, used by AppEndFrame.
+void TelemetryEndFrame();
+
+// Monotonic time in milliseconds, the clock latencies are measured with.
+double TelemetryNow();
+
+// Record the time from inputTime to now as the latency of the current frame,
+// used by AppEndFrame once the frame is presented.
+void TelemetryRecordLatency(double inputTime);
+
+// Export if requested and free the timer queries, used by AppClose.
+void TelemetryShutdown();